@@ -0,0 +1,321 @@
+// Benchmark of TaskGraphExecutor on synthetic DAGs.
+//
+// Every graph is run with 1, 2, 4, ... up to the maximum thread count, and the
+// best of several runs is reported as tasks per second, the wall time per
+// task and the scheduling overhead per task, i.e., the worker time spent per
+// task beyond what running the same tasks serially in a topological order
+// costs. With the default empty tasks, the overhead is the whole cost of the
+// scheduler.
+//
+// Usage: bench_TaskGraphExecutor [--threads N] [--work ITERATIONS]
+//                                [--repeat R] [--scale S] [--graph NAME]
+//                                [--csv]
+
+#include <algorithm>
+#include <chrono>
+#include <cppkit/TaskGraphExecutor.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Graph = cppkit::TaskGraph<>;
+using TaskType = cppkit::Task<>;
+
+struct Options {
+  int threads = static_cast<int>(std::thread::hardware_concurrency());
+  int work = 0;  // Spinning iterations per task
+  int repeat = 5;
+  double scale = 1;
+  std::string graph;  // Run only graphs with this name if not empty
+  bool csv = false;
+};
+
+// Spin for a number of iterations without being optimized away
+void spin(int iterations) {
+  volatile uint64_t x = 0;
+  for (int i = 0; i < iterations; i++) x = x + i;
+}
+
+TaskType* addTask(Graph& g, int work) {
+  return g.emplace([work] { spin(work); });
+}
+
+//
+// Generators
+//
+
+// A chain of n tasks, which has no parallelism at all
+void chain(Graph& g, int n, int work) {
+  TaskType* last = nullptr;
+  for (int i = 0; i < n; i++) {
+    TaskType* t = addTask(g, work);
+    if (last) last->addDownstreamTask(t);
+    last = t;
+  }
+}
+
+// `depth` rounds of forking `width` tasks and joining them
+void forkJoin(Graph& g, int width, int depth, int work) {
+  TaskType* join = addTask(g, work);
+  for (int d = 0; d < depth; d++) {
+    TaskType* next = addTask(g, work);
+    for (int i = 0; i < width; i++) {
+      TaskType* t = addTask(g, work);
+      join->addDownstreamTask(t);
+      t->addDownstreamTask(next);
+    }
+    join = next;
+  }
+}
+
+// A 1D three-point stencil of `width` cells over `steps` time steps
+void stencil(Graph& g, int width, int steps, int work) {
+  std::vector<TaskType*> previous, current(width);
+  for (int s = 0; s < steps; s++) {
+    for (int x = 0; x < width; x++) {
+      current[x] = addTask(g, work);
+      if (previous.empty()) continue;
+      for (int dx = -1; dx <= 1; dx++) {
+        if (x + dx >= 0 && x + dx < width) {
+          previous[x + dx]->addDownstreamTask(current[x]);
+        }
+      }
+    }
+    previous = current;
+  }
+}
+
+// `layers` layers of `width` tasks, every task depending on `degree` random
+// tasks of the previous layer
+void randomLayered(Graph& g, int layers, int width, int degree, int work) {
+  std::mt19937 rng(42);
+  std::vector<TaskType*> previous, current(width);
+  for (int l = 0; l < layers; l++) {
+    for (int x = 0; x < width; x++) {
+      current[x] = addTask(g, work);
+      for (int k = 0; k < degree && !previous.empty(); k++) {
+        previous[rng() % width]->addDownstreamTask(current[x]);
+      }
+    }
+    previous = current;
+  }
+}
+
+// Track the last writer of every tile of a tiled matrix, so a task reading
+// or writing tiles depends on their last writers.
+struct Tiles {
+  explicit Tiles(int n) : n(n), writers(n * n, nullptr) {}
+  void access(TaskType* t, int i, int j, bool write) {
+    TaskType*& w = writers[i * n + j];
+    if (w && w != t) w->addDownstreamTask(t);
+    if (write) w = t;
+  }
+  int n;
+  std::vector<TaskType*> writers;
+};
+
+// A right-looking tiled Cholesky factorization of `n` x `n` tiles
+void cholesky(Graph& g, int n, int work) {
+  Tiles tiles(n);
+  for (int k = 0; k < n; k++) {
+    TaskType* potrf = addTask(g, work);
+    tiles.access(potrf, k, k, true);
+    for (int i = k + 1; i < n; i++) {
+      TaskType* trsm = addTask(g, work);
+      tiles.access(trsm, k, k, false);
+      tiles.access(trsm, i, k, true);
+    }
+    for (int i = k + 1; i < n; i++) {
+      TaskType* syrk = addTask(g, work);
+      tiles.access(syrk, i, k, false);
+      tiles.access(syrk, i, i, true);
+      for (int j = k + 1; j < i; j++) {
+        TaskType* gemm = addTask(g, work);
+        tiles.access(gemm, i, k, false);
+        tiles.access(gemm, j, k, false);
+        tiles.access(gemm, i, j, true);
+      }
+    }
+  }
+}
+
+// A tiled LU factorization without pivoting of `n` x `n` tiles
+void lu(Graph& g, int n, int work) {
+  Tiles tiles(n);
+  for (int k = 0; k < n; k++) {
+    TaskType* getrf = addTask(g, work);
+    tiles.access(getrf, k, k, true);
+    for (int j = k + 1; j < n; j++) {
+      TaskType* row = addTask(g, work);
+      tiles.access(row, k, k, false);
+      tiles.access(row, k, j, true);
+      TaskType* column = addTask(g, work);
+      tiles.access(column, k, k, false);
+      tiles.access(column, j, k, true);
+    }
+    for (int i = k + 1; i < n; i++) {
+      for (int j = k + 1; j < n; j++) {
+        TaskType* gemm = addTask(g, work);
+        tiles.access(gemm, i, k, false);
+        tiles.access(gemm, k, j, false);
+        tiles.access(gemm, i, j, true);
+      }
+    }
+  }
+}
+
+// One task releasing `width` tasks at once
+void fanOut(Graph& g, int width, int work) {
+  TaskType* source = addTask(g, work);
+  for (int i = 0; i < width; i++) {
+    source->addDownstreamTask(addTask(g, work));
+  }
+}
+
+struct Generator {
+  const char* name;
+  std::function<void(Graph&, double, int)> build;  // (graph, scale, work)
+};
+
+std::vector<Generator> generators() {
+  auto size = [](int n, double scale) {
+    return std::max(1, static_cast<int>(n * scale));
+  };
+  return {
+      {"chain",
+       [=](Graph& g, double s, int w) { chain(g, size(100000, s), w); }},
+      {"fork-join",
+       [=](Graph& g, double s, int w) { forkJoin(g, 1000, size(100, s), w); }},
+      {"stencil",
+       [=](Graph& g, double s, int w) { stencil(g, 1000, size(100, s), w); }},
+      {"random-layered",
+       [=](Graph& g, double s, int w) {
+         randomLayered(g, size(100, s), 1000, 4, w);
+       }},
+      {"cholesky",
+       [=](Graph& g, double s, int w) { cholesky(g, size(40, s), w); }},
+      {"lu", [=](Graph& g, double s, int w) { lu(g, size(30, s), w); }},
+      {"fan-out",
+       [=](Graph& g, double s, int w) { fanOut(g, size(100000, s), w); }},
+  };
+}
+
+//
+// Measurement
+//
+
+double seconds(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration<double>(d).count();
+}
+
+// Run the tasks serially in a topological order, return the best time.
+double runSerial(Graph& g, int repeat) {
+  g.freeze();
+  auto order = g.topologicalOrder();
+  double best = 1e300;
+  for (int r = 0; r < repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i : order) g.taskAt(i)->progress();
+    best = std::min(best, seconds(std::chrono::steady_clock::now() - start));
+  }
+  return best;
+}
+
+// Run the graph with an executor, return the best time after a warm-up run.
+double runParallel(Graph& g, int threads, int repeat) {
+  cppkit::TaskGraphExecutor<> executor(threads);
+  executor.run(g);
+  double best = 1e300;
+  for (int r = 0; r < repeat; r++) {
+    auto start = std::chrono::steady_clock::now();
+    executor.run(g);
+    best = std::min(best, seconds(std::chrono::steady_clock::now() - start));
+  }
+  return best;
+}
+
+bool parse(int argc, char* argv[], Options& options) {
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (std::strcmp(arg, "--csv") == 0) {
+      options.csv = true;
+      continue;
+    }
+    if (!value) return false;
+    if (std::strcmp(arg, "--threads") == 0) {
+      options.threads = std::atoi(value);
+    } else if (std::strcmp(arg, "--work") == 0) {
+      options.work = std::atoi(value);
+    } else if (std::strcmp(arg, "--repeat") == 0) {
+      options.repeat = std::atoi(value);
+    } else if (std::strcmp(arg, "--scale") == 0) {
+      options.scale = std::atof(value);
+    } else if (std::strcmp(arg, "--graph") == 0) {
+      options.graph = value;
+    } else {
+      return false;
+    }
+    i++;
+  }
+  options.threads = std::max(1, options.threads);
+  options.repeat = std::max(1, options.repeat);
+  return options.scale > 0;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!parse(argc, argv, options)) {
+    std::fprintf(stderr,
+                 "usage: %s [--threads N] [--work ITERATIONS] [--repeat R] "
+                 "[--scale S] [--graph NAME] [--csv]\n",
+                 argv[0]);
+    return 1;
+  }
+  std::vector<int> threadCounts;
+  for (int n = 1; n < options.threads; n *= 2) threadCounts.push_back(n);
+  threadCounts.push_back(options.threads);
+
+  if (options.csv) {
+    std::printf("graph,tasks,edges,threads,seconds,tasks_per_second,"
+                "ns_per_task,overhead_ns_per_task,speedup\n");
+  } else {
+    std::printf("%-15s %8s %8s %7s %12s %10s %14s %8s\n", "graph", "tasks",
+                "edges", "threads", "tasks/s", "ns/task", "overhead ns",
+                "speedup");
+  }
+  for (auto& generator : generators()) {
+    if (!options.graph.empty() && options.graph != generator.name) continue;
+    Graph g;
+    generator.build(g, options.scale, options.work);
+    g.freeze();
+    const double n = static_cast<double>(g.taskCount());
+    const double serial = runSerial(g, options.repeat);
+    double base = 0;
+    for (auto threads : threadCounts) {
+      const double t = runParallel(g, threads, options.repeat);
+      if (threads == 1) base = t;
+      const double overhead = (t * threads - serial) / n * 1e9;
+      if (options.csv) {
+        std::printf("%s,%zu,%zu,%d,%.6f,%.0f,%.1f,%.1f,%.2f\n",
+                    generator.name, g.taskCount(), g.edgeCount(), threads, t,
+                    n / t, t / n * 1e9, overhead, base / t);
+      } else {
+        std::printf("%-15s %8zu %8zu %7d %12.0f %10.1f %14.1f %8.2f\n",
+                    generator.name, g.taskCount(), g.edgeCount(), threads,
+                    n / t, t / n * 1e9, overhead, base / t);
+      }
+      std::fflush(stdout);
+    }
+  }
+  return 0;
+}
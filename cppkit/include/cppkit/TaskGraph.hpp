@@ -5,9 +5,16 @@
 #include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <new>
 #include <queue>
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -35,6 +42,17 @@ namespace taskgraph {
 struct WithTag {};
 struct WithPriority {};
 struct WithTagAndPriority {};
+
+// Resources a task holds from its dispatch until it finishes, which
+// TaskGraphExecutor gates against the budgets of `ExecutorOptions::budget`.
+struct Resources {
+  int64_t memory = 0;  // Bytes of memory
+  int ioSlots = 0;     // Concurrent I/O operations, e.g., open files
+  // Bytes of memory which stay released when the task finishes, e.g., the
+  // inputs it consumes. Among the ready tasks waiting for resources, those
+  // with the least `memory - freedMemory` are dispatched first.
+  int64_t freedMemory = 0;
+};
 }  // namespace taskgraph
 
 namespace detail {
@@ -59,6 +77,7 @@ struct tag_traits<taskgraph::WithTagAndPriority> {
   static const bool priority = true;
 };
 
+struct NoMetaData {};
 struct TagAndPriority {
   int tag;
   double priority;
@@ -72,7 +91,7 @@ struct Priority {
 
 template <typename Tag>
 struct MetaDataSelector {
-  using type = void;
+  using type = NoMetaData;
 };
 template <>
 struct MetaDataSelector<taskgraph::WithTag> {
@@ -86,6 +105,200 @@ template <>
 struct MetaDataSelector<taskgraph::WithTagAndPriority> {
   using type = TagAndPriority;
 };
+
+// A non-owning view of a contiguous range
+template <typename T>
+struct Span {
+  Span() = default;
+  Span(T* first, T* last) : first_(first), last_(last) {}
+  T* begin() const { return first_; }
+  T* end() const { return last_; }
+  size_t size() const { return last_ - first_; }
+  bool empty() const { return first_ == last_; }
+  T& operator[](size_t i) const { return first_[i]; }
+
+private:
+  T* first_ = nullptr;
+  T* last_ = nullptr;
+};
+
+// An array reused across calls, growing on demand. Copies start empty.
+template <typename T>
+struct ScratchArray {
+  ScratchArray() = default;
+  ScratchArray(const ScratchArray&) {}
+  ScratchArray& operator=(const ScratchArray&) { return *this; }
+  // Return an array of at least n elements. The content is unspecified.
+  T* get(size_t n) {
+    if (n > capacity_) {
+      data_.reset(new T[n]);
+      capacity_ = n;
+    }
+    return data_.get();
+  }
+  // Return the array returned by the last `get()`.
+  T* data() const { return data_.get(); }
+
+private:
+  std::unique_ptr<T[]> data_;
+  size_t capacity_ = 0;
+};
+
+// A reusable spinning barrier for a fixed number of threads
+struct SpinBarrier {
+  void reset(int threadCount) { threadCount_ = threadCount; }
+  void wait() {
+    int generation = generation_.load(std::memory_order_acquire);
+    if (arrived_.fetch_add(1, std::memory_order_acq_rel) + 1 == threadCount_) {
+      arrived_.store(0, std::memory_order_relaxed);
+      generation_.fetch_add(1, std::memory_order_acq_rel);
+      return;
+    }
+    while (generation_.load(std::memory_order_acquire) == generation) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  int threadCount_ = 1;
+  std::atomic<int> arrived_{0};
+  std::atomic<int> generation_{0};
+};
+
+// A bump allocator owning objects derived from T, which shall have a virtual
+// destructor. Objects are carved from large blocks, so creating one does not
+// allocate most of the time. Every object is preceded by a link to the one
+// created before, so the arena keeps no other per-object bookkeeping, and they
+// are destroyed in reverse creation order with the arena.
+template <typename T>
+struct Arena {
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena() {
+    for (const Link* l = last_; l; l = l->previous) l->object->~T();
+  }
+
+  // Construct an object of type U in the arena.
+  template <typename U, typename... Args>
+  U* create(Args&&... args) {
+    // The link is carved first, and only linked once the object is built
+    void* link = allocate(sizeof(Link), alignof(Link));
+    U* u = new (allocate(sizeof(U), alignof(U))) U(std::forward<Args>(args)...);
+    last_ = new (link) Link{u, last_};
+    size_++;
+    return u;
+  }
+  // Return how many objects are created.
+  size_t size() const { return size_; }
+
+private:
+  struct Link {
+    T* object;
+    const Link* previous;
+  };
+
+  void* allocate(size_t size, size_t align) {
+    void* p = cursor_;
+    if (!std::align(align, size, p, space_)) {
+      const size_t blockSize = 64 * 1024;
+      size_t n = std::max(blockSize, size + align);
+      blocks_.emplace_back(new char[n]);
+      p = blocks_.back().get();
+      space_ = n;
+      std::align(align, size, p, space_);
+    }
+    cursor_ = static_cast<char*>(p) + size;
+    space_ -= size;
+    return p;
+  }
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  void* cursor_ = nullptr;
+  size_t space_ = 0;
+  const Link* last_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Call a task body, which returns whether the task is finished or nothing if
+// it always finishes in one go.
+template <typename F>
+auto invokeTask(F& f) ->
+    typename std::enable_if<std::is_void<decltype(f())>::value, bool>::type {
+  f();
+  return true;
+}
+template <typename F>
+auto invokeTask(F& f) ->
+    typename std::enable_if<!std::is_void<decltype(f())>::value, bool>::type {
+  return f();
+}
+
+// Storage for one output value of a `FlowTask`. The producer moves its result
+// in, the consumers read it in place, and the last consumer to finish destroys
+// it. An output without consumers keeps its value until the next run or the
+// destruction of the graph.
+template <typename T>
+struct ValueSlot {
+  ValueSlot() = default;
+  ValueSlot(const ValueSlot&) = delete;
+  ValueSlot& operator=(const ValueSlot&) = delete;
+  ~ValueSlot() { clear(); }
+
+  // Store a value, replacing the one of the last run, if any.
+  void put(T&& value) {
+    clear();
+    new (&storage_) T(std::move(value));
+    full_ = true;
+    pending_.store(consumers_, std::memory_order_relaxed);
+  }
+  T& get() { return *reinterpret_cast<T*>(&storage_); }
+  bool full() const { return full_; }
+  // Called by every consumer when it finishes.
+  void consume() {
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) clear();
+  }
+  void clear() {
+    if (full_) {
+      get().~T();
+      full_ = false;
+    }
+  }
+
+  int consumers_ = 0;  // Set when building the graph
+  std::atomic<int> pending_{0};
+  bool full_ = false;
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+};
+
+// The output of a `FlowTask`, empty for callables returning nothing
+template <typename R>
+struct FlowOutput {
+  template <typename F, typename... Args>
+  void run(F& f, Args&... args) {
+    slot.put(f(args...));
+  }
+  ValueSlot<R>* get() { return &slot; }
+
+  ValueSlot<R> slot;
+};
+template <>
+struct FlowOutput<void> {
+  template <typename F, typename... Args>
+  void run(F& f, Args&... args) {
+    f(args...);
+  }
+  ValueSlot<void>* get() { return nullptr; }
+};
+
+// Shared state of the threads validating a frozen TaskGraph
+struct ValidationState {
+  SpinBarrier barrier;
+  std::atomic<size_t> tail{0};    // End of the topological order found
+  std::atomic<size_t> cursor{0};  // Next frontier chunk to process
+  std::atomic<bool> countsMatch{true};
+  std::atomic<bool> hasSink{false};
+};
 }  // namespace detail
 
 struct BaseTask {
@@ -140,9 +353,16 @@ struct BaseTask {
 private:
   int upstreamCount_ = 0;
   std::atomic<int> pendingUpstreamCount_;
-  std::vector<BaseTask*> downstreamTasks_;
+  std::unordered_set<BaseTask*> downstreamTasks_;
 };
 
+template <typename Tag>
+struct TaskGraph;
+template <typename Tag>
+struct SubgraphTask;
+template <typename Tag>
+struct TaskGraphExecutor;
+
 /*
  * An interface for a task.
  */
@@ -151,16 +371,19 @@ struct Task {
   // Create a regular task
   Task() = default;
   // Create a task with specific tag
-  template <typename std::enable_if<detail::tag_traits<Tag>::tag &&
-                                        !detail::tag_traits<Tag>::priority,
+  template <typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag &&
+                                        !detail::tag_traits<T>::priority,
                                     int>::type = 0>
   Task(int tag) : metaData_{tag} {}
-  template <std::enable_if_t<!detail::tag_traits<Tag>::tag &&
-                                 detail::tag_traits<Tag>::priority,
+  template <typename T = Tag,
+            std::enable_if_t<!detail::tag_traits<T>::tag &&
+                                 detail::tag_traits<T>::priority,
                              int> = 0>
-  Task(double priority) : metaData_{0, priority} {}
-  template <std::enable_if_t<detail::tag_traits<Tag>::tag &&
-                                 detail::tag_traits<Tag>::priority,
+  Task(double priority) : metaData_{priority} {}
+  template <typename T = Tag,
+            std::enable_if_t<detail::tag_traits<T>::tag &&
+                                 detail::tag_traits<T>::priority,
                              int> = 0>
   Task(int tag, double priority) : metaData_{tag, priority} {}
   // Destroy the task
@@ -172,30 +395,39 @@ struct Task {
   // Query or set the task properties
 
   // Query the tag of this task
-  template <
-      typename std::enable_if<detail::tag_traits<Tag>::tag, int>::type = 0>
+  template <typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag, int>::type = 0>
   int tag() const {
     return metaData_.tag;
   }
   // Set the tag of this task
-  template <
-      typename std::enable_if<detail::tag_traits<Tag>::tag, int>::type = 0>
+  template <typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag, int>::type = 0>
   void setTag(int tag) {
     metaData_.tag = tag;
   };
   // Query the tag of this task
   template <
-      typename std::enable_if<detail::tag_traits<Tag>::priority, int>::type = 0>
+      typename T = Tag,
+      typename std::enable_if<detail::tag_traits<T>::priority, int>::type = 0>
   double priority() const {
     return metaData_.priority;
   }
   // Set the tag of this task
   template <
-      typename std::enable_if<detail::tag_traits<Tag>::priority, int>::type = 0>
+      typename T = Tag,
+      typename std::enable_if<detail::tag_traits<T>::priority, int>::type = 0>
   void setPriority(double priority) {
     metaData_.priority = priority;
   };
 
+  // Query the resources the task holds while running
+  const taskgraph::Resources& resources() const { return resources_; }
+  // Set the resources the task holds while running
+  void setResources(const taskgraph::Resources& resources) {
+    resources_ = resources;
+  }
+
   // Query all downstream tasks
   const std::unordered_set<Task*>& downstreamTasks() {
     return downstreamTasks_;
@@ -208,6 +440,10 @@ struct Task {
       t->upstreamCount_++;
     }
   }
+  // Remove a downstream task
+  void removeDownstreamTask(Task* t) {
+    if (downstreamTasks_.erase(t) > 0) t->upstreamCount_--;
+  }
   // Query the upstream task count
   int upstreamCount() const { return upstreamCount_; }
   // Add an upstream task. Please either addUpstreamTask or addDownstreamTask
@@ -222,6 +458,23 @@ struct Task {
 
   // Reset the task to ready-for-schedule state
   void reset() { pendingUpstreamCount_ = upstreamCount_; }
+  // Query how many upstream tasks are not finished yet
+  int pendingUpstreamCount() const {
+    return pendingUpstreamCount_.load(std::memory_order_acquire);
+  }
+  // Notify the task that one of its upstream tasks is finished. Return whether
+  // the task becomes ready for schedule. It is safe to call concurrently.
+  bool notifyUpstreamFinished() {
+    return pendingUpstreamCount_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+  // Query the dense index of the task in the last frozen graph containing it,
+  // -1 if the task has never been frozen. See `TaskGraph::freeze()`.
+  int index() const { return index_; }
+  // Query the child graph if this is a `SubgraphTask`, nullptr otherwise.
+  TaskGraph<Tag>* subgraph() const { return subgraph_; }
+  // Query the subgraph task whose child graph contains this task, nullptr for
+  // tasks of the top-level graph. It is set when the child graph is expanded.
+  Task* parent() const { return parent_; }
 
   //
   // Abstract interfaces for task definition
@@ -235,27 +488,227 @@ struct Task {
   virtual std::string id() const = 0;
 
 private:
+  friend struct TaskGraph<Tag>;
+  friend struct SubgraphTask<Tag>;
+  friend struct TaskGraphExecutor<Tag>;
+
   int upstreamCount_ = 0;
-  std::atomic<int> pendingUpstreamCount_;
+  int index_ = -1;
+  TaskGraph<Tag>* subgraph_ = nullptr;
+  Task* parent_ = nullptr;
+  std::atomic<int> pendingUpstreamCount_{0};
   std::unordered_set<Task*> downstreamTasks_;
-  detail::MetaDataSelector<Tag> metaData_;
+  typename detail::MetaDataSelector<Tag>::type metaData_{};
+  taskgraph::Resources resources_;
+};
+
+namespace detail {
+// Query the priority of a task, 0 for tasks without priority metadata
+template <typename Tag,
+          typename std::enable_if<tag_traits<Tag>::priority, int>::type = 0>
+double taskPriority(const Task<Tag>* t) {
+  return t->priority();
+}
+template <typename Tag,
+          typename std::enable_if<!tag_traits<Tag>::priority, int>::type = 0>
+double taskPriority(const Task<Tag>*) {
+  return 0.0;
+}
+// Query the tag of a task, 0 for tasks without tag metadata
+template <typename Tag,
+          typename std::enable_if<tag_traits<Tag>::tag, int>::type = 0>
+int taskTag(const Task<Tag>* t) {
+  return t->tag();
+}
+template <typename Tag,
+          typename std::enable_if<!tag_traits<Tag>::tag, int>::type = 0>
+int taskTag(const Task<Tag>*) {
+  return 0;
+}
+// Set the tag or the priority of a task, if it has such metadata
+template <typename Tag,
+          typename std::enable_if<tag_traits<Tag>::tag, int>::type = 0>
+void setTaskTag(Task<Tag>* t, int tag) {
+  t->setTag(tag);
+}
+template <typename Tag,
+          typename std::enable_if<!tag_traits<Tag>::tag, int>::type = 0>
+void setTaskTag(Task<Tag>*, int) {}
+template <typename Tag,
+          typename std::enable_if<tag_traits<Tag>::priority, int>::type = 0>
+void setTaskPriority(Task<Tag>* t, double priority) {
+  t->setPriority(priority);
+}
+template <typename Tag,
+          typename std::enable_if<!tag_traits<Tag>::priority, int>::type = 0>
+void setTaskPriority(Task<Tag>*, double) {}
+}  // namespace detail
+
+/*
+ * A task running a callable, see `TaskGraph::emplace()`. The callable is
+ * stored inline, so the task is one object without further allocations.
+ */
+template <typename Tag, typename F>
+struct FunctionTask final : Task<Tag> {
+  // Create a task with a sequence number for `id()`, the callable and the
+  // task metadata (the tag and/or the priority).
+  template <typename G, typename... Args>
+  FunctionTask(size_t sequence, G&& f, Args&&... args)
+      : Task<Tag>(std::forward<Args>(args)...),
+        sequence_(sequence),
+        f_(std::forward<G>(f)) {}
+
+  bool progress() override { return finished_ = detail::invokeTask(f_); }
+  bool finished() const override { return finished_; }
+  std::string id() const override { return "#" + std::to_string(sequence_); }
+
+private:
+  size_t sequence_;
+  bool finished_ = false;
+  F f_;
+};
+
+template <typename T, typename Tag>
+struct Future;
+
+/*
+ * A task passing data along its edges, see `TaskGraph::emplaceFlow()`. The
+ * callable receives the values of its input futures as lvalue references to
+ * their slots, and its result is moved into the output slot of the task.
+ */
+template <typename Tag, typename R, typename F, typename... Ts>
+struct FlowTask final : Task<Tag> {
+  template <typename G>
+  FlowTask(size_t sequence, G&& f, detail::ValueSlot<Ts>*... inputs)
+      : sequence_(sequence), f_(std::forward<G>(f)), inputs_(inputs...) {}
+
+  bool progress() override {
+    run(std::index_sequence_for<Ts...>{});
+    return finished_ = true;
+  }
+  bool finished() const override { return finished_; }
+  std::string id() const override { return "#" + std::to_string(sequence_); }
+
+  // Query the output slot, nullptr if the callable returns nothing
+  detail::ValueSlot<R>* output() { return output_.get(); }
+
+private:
+  template <size_t... I>
+  void run(std::index_sequence<I...>) {
+    output_.run(f_, std::get<I>(inputs_)->get()...);
+    int consumed[] = {0, (std::get<I>(inputs_)->consume(), 0)...};
+    (void)consumed;
+  }
+
+  size_t sequence_;
+  bool finished_ = false;
+  F f_;
+  std::tuple<detail::ValueSlot<Ts>*...> inputs_;
+  detail::FlowOutput<R> output_;
+};
+
+/*
+ * A handle to the output of a `FlowTask`, which is passed to
+ * `TaskGraph::emplaceFlow()` as an input of downstream tasks.
+ */
+template <typename T, typename Tag = void>
+struct Future {
+  Future() = default;
+
+  // Query the producing task
+  Task<Tag>* task() const { return task_; }
+  // Check if the slot holds a value. It does from the end of the producer
+  // until the last consumer finishes, so only outputs without consumers are
+  // ready after a run.
+  template <typename U = T,
+            typename std::enable_if<!std::is_void<U>::value, int>::type = 0>
+  bool ready() const {
+    return slot_->full();
+  }
+  // Access the value, which shall be ready.
+  template <typename U = T,
+            typename std::enable_if<!std::is_void<U>::value, int>::type = 0>
+  U& get() const {
+    return slot_->get();
+  }
+
+private:
+  friend struct TaskGraph<Tag>;
+  Future(Task<Tag>* task, detail::ValueSlot<T>* slot)
+      : task_(task), slot_(slot) {}
+
+  Task<Tag>* task_ = nullptr;
+  detail::ValueSlot<T>* slot_ = nullptr;
+};
+
+/*
+ * A super-task running several tasks one after another, see
+ * `TaskGraph::coarsen()`. The member tasks keep their identities for
+ * diagnostics. An unfinished member is progressed again when the super-task
+ * is, without running the members after it.
+ */
+template <typename Tag>
+struct FusedTask final : Task<Tag> {
+  // Create a super-task of tasks in a topological order. It takes the tag of
+  // the first member, the highest priority and the largest resources of all
+  // members, and frees the memory all members free.
+  explicit FusedTask(std::vector<Task<Tag>*> members)
+      : members_(std::move(members)) {
+    double priority = -std::numeric_limits<double>::infinity();
+    taskgraph::Resources resources;
+    for (auto t : members_) {
+      priority = std::max(priority, detail::taskPriority(t));
+      resources.memory = std::max(resources.memory, t->resources().memory);
+      resources.ioSlots = std::max(resources.ioSlots, t->resources().ioSlots);
+      resources.freedMemory += t->resources().freedMemory;
+    }
+    this->setResources(resources);
+    detail::setTaskTag<Tag>(this, detail::taskTag(members_.front()));
+    detail::setTaskPriority<Tag>(this, priority);
+  }
+
+  // Query the member tasks in execution order
+  const std::vector<Task<Tag>*>& members() const { return members_; }
+
+  bool progress() override {
+    if (next_ == members_.size()) next_ = 0;  // A new run
+    while (next_ < members_.size()) {
+      if (!members_[next_]->progress()) return false;
+      next_++;
+    }
+    return true;
+  }
+  bool finished() const override { return next_ == members_.size(); }
+  // Return the identities of the members joined by '+'
+  std::string id() const override {
+    std::string id;
+    for (auto t : members_) id += (id.empty() ? "" : "+") + t->id();
+    return id;
+  }
+
+private:
+  std::vector<Task<Tag>*> members_;
+  size_t next_ = 0;  // The first unfinished member
 };
 
 /*
  * A TaskGraph for a set of tasks. The graph is non-owning. Users shall
  * place tasks in other owning containers and ensures the tasks are alive
- * during scheduling.
+ * during scheduling. The exception is the tasks created by `emplace()`, which
+ * are owned by the graph.
  *
  * The TaskGraph is merely used for facilitating task scheduling. The users
- * shall build their own scheduler by making use of the
+ * can either run it with `TaskGraphExecutor` (see TaskGraphExecutor.hpp) or
+ * build their own scheduler by making use of `reset()` and the pending
+ * upstream counts of the tasks.
  */
 template <typename Tag = void>
 struct TaskGraph {
   TaskGraph() = default;
 
   // Return how many tags are in the task graph
-  template <
-      typename std::enable_if<detail::tag_traits<Tag>::tag, int>::type = 0>
+  template <typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag, int>::type = 0>
   int tagCount() const {
     return tasksByTag_.size();
   }
@@ -263,22 +716,367 @@ struct TaskGraph {
   size_t taskCount() const { return taskCount_; }
 
   // Add a task into the task graph.
-  template <
-      typename std::enable_if<detail::tag_traits<Tag>::tag, int>::type = 0>
+  template <typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag, int>::type = 0>
   void addTask(Task<Tag>* t) {
-    tasksByTag_[t->tag()].push_back(t);
-    taskCount_++;
+    addTask_(t, t->tag());
   }
-  template <
-      typename std::enable_if<!detail::tag_traits<Tag>::tag, int>::type = 0>
+  template <typename T = Tag,
+            typename std::enable_if<!detail::tag_traits<T>::tag, int>::type = 0>
   void addTask(Task<Tag>* t) {
-    tasksByTag_[0].push_back(t);
-    taskCount_++;
+    addTask_(t, 0);
+  }
+  // Create a task running a callable and add it into the task graph. The
+  // callable returns nothing, or whether the task is finished as
+  // `Task::progress()`. `args` are the task metadata, i.e., the tag and/or the
+  // priority.
+  //
+  // The task is allocated from an arena of the graph instead of its own heap
+  // block, and is destroyed by `clear()` or with the last copy of the graph.
+  // Removing it from the graph does not destroy it.
+  template <typename F, typename... Args>
+  Task<Tag>* emplace(F&& f, Args&&... args) {
+    using TaskType = FunctionTask<Tag, typename std::decay<F>::type>;
+    return emplaceTask<TaskType>(arenaSize(), std::forward<F>(f),
+                                 std::forward<Args>(args)...);
+  }
+  // Create a task consuming the values of futures and producing one, i.e., a
+  // data-flow node. `f` is called with an lvalue reference to the value of
+  // each input and its result is moved into a slot of the new task, so values
+  // are never copied. An edge from the producer of each input is added. The
+  // value of a future is destroyed as soon as its last consumer finishes,
+  // bounding the memory of long pipelines by their width. A consumer may move
+  // from its input if it is the only consumer of the future.
+  //
+  // The task is owned by the graph as by `emplace()` and has the default
+  // metadata. Futures shall be consumed within the same graph.
+  template <typename F, typename... Ts>
+  auto emplaceFlow(F&& f, const Future<Ts, Tag>&... inputs)
+      -> Future<decltype(std::declval<typename std::decay<F>::type&>()(
+                     std::declval<Ts&>()...)),
+                 Tag> {
+    using R = decltype(std::declval<typename std::decay<F>::type&>()(
+        std::declval<Ts&>()...));
+    using TaskType = FlowTask<Tag, R, typename std::decay<F>::type, Ts...>;
+    TaskType* t =
+        emplaceTask<TaskType>(arenaSize(), std::forward<F>(f), inputs.slot_...);
+    int connected[] = {0, (inputs.task_->addDownstreamTask(t),
+                           inputs.slot_->consumers_++, 0)...};
+    (void)connected;
+    return Future<R, Tag>(t, t->output());
+  }
+  // Create a task of type T (derived from Task) owned by the graph in the same
+  // way, and add it into the task graph.
+  template <typename T, typename... Args>
+  T* emplaceTask(Args&&... args) {
+    if (!arena_) arena_ = std::make_shared<detail::Arena<Task<Tag>>>();
+    T* t = arena_->template create<T>(std::forward<Args>(args)...);
+    addTask(t);
+    return t;
   }
   // Clear all tasks
   void clear() {
     tasksByTag_.clear();
     taskCount_ = 0;
+    frozen_ = false;
+    tasks_.clear();
+    offsets_.clear();
+    targets_.clear();
+    incremental_ = false;
+    nodes_.clear();
+    dirty_.clear();
+    arena_.reset();
+  }
+
+  //
+  // Compact storage of the finalized graph
+  //
+  // `freeze()` assigns every task a dense index in [0, taskCount()) and packs
+  // all downstream edges into one CSR (compressed sparse row) array, so
+  // traversal walks contiguous memory instead of per-task hash sets. Adding a
+  // task unfreezes the graph. Modifying the edges of a frozen graph is not
+  // tracked, so call `freeze()` again after that.
+  //
+
+  // Pack the graph into the CSR representation.
+  void freeze() {
+    frozen_ = false;  // Make foreach walk the tags, not the stale tasks_
+    tasks_.clear();
+    tasks_.reserve(taskCount_);
+    foreach ([this](Task<Tag>* t) {
+      t->index_ = static_cast<int>(tasks_.size());
+      tasks_.push_back(t);
+    })
+      ;
+    offsets_.assign(tasks_.size() + 1, 0);
+    for (size_t i = 0; i < tasks_.size(); i++) {
+      offsets_[i + 1] = offsets_[i] + tasks_[i]->downstreamTasks().size();
+    }
+    targets_.resize(offsets_.back());
+    for (size_t i = 0; i < tasks_.size(); i++) {
+      uint32_t* out = targets_.data() + offsets_[i];
+      for (auto d : tasks_[i]->downstreamTasks()) {
+        if (d->index_ < 0 || static_cast<size_t>(d->index_) >= tasks_.size() ||
+            tasks_[d->index_] != d) {
+          throw std::invalid_argument("TaskGraph::freeze: downstream task '" +
+                                      d->id() + "' is not in the graph");
+        }
+        *out++ = static_cast<uint32_t>(d->index_);
+      }
+    }
+    frozen_ = true;
+  }
+  // Check if the graph is frozen.
+  bool frozen() const { return frozen_; }
+  // Return the task with specific dense index. The graph shall be frozen.
+  Task<Tag>* taskAt(size_t index) const { return tasks_[index]; }
+  // Return all tasks ordered by dense index. The graph shall be frozen.
+  detail::Span<Task<Tag>* const> tasks() const {
+    return {tasks_.data(), tasks_.data() + tasks_.size()};
+  }
+  // Return the dense indices of the downstream tasks of the task with
+  // specific dense index. The graph shall be frozen.
+  detail::Span<const uint32_t> downstreamIndices(size_t index) const {
+    return {targets_.data() + offsets_[index],
+            targets_.data() + offsets_[index + 1]};
+  }
+  // Return how many edges are in the graph. The graph shall be frozen.
+  size_t edgeCount() const { return targets_.size(); }
+  // Return the dense indices of all tasks in a topological order. The graph
+  // shall be frozen. If the graph is cyclic, the tasks in or after a cycle are
+  // missing, so the result is shorter than `taskCount()`.
+  std::vector<uint32_t> topologicalOrder() const {
+    const size_t n = tasks_.size();
+    std::vector<int> counts(n);
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      counts[i] = tasks_[i]->upstreamCount();
+      if (counts[i] == 0) order.push_back(static_cast<uint32_t>(i));
+    }
+    for (size_t head = 0; head < order.size(); head++) {
+      for (auto j : downstreamIndices(order[head])) {
+        if (--counts[j] == 0) order.push_back(j);
+      }
+    }
+    return order;
+  }
+
+  //
+  // Incremental mutation
+  //
+  // `addEdge()`, `removeEdge()` and `removeTask()` edit a live graph and keep
+  // it acyclic. The graph maintains a topological order of its tasks online
+  // (Pearce-Kelly), so inserting an edge only searches and reorders the tasks
+  // positioned between its two endpoints, and an edge closing a cycle is
+  // rejected before anything changes. The first edit indexes the whole graph
+  // once, later edits cost time proportional to the affected region. Edited
+  // tasks are marked dirty, and `revalidate()` rechecks only those.
+  //
+  // After the first edit, connect tasks with these methods rather than
+  // `Task::addDownstreamTask()`, and add tasks without edges. Edits unfreeze
+  // the graph.
+  //
+
+  // Add an edge. Return false and leave the graph unchanged if the edge would
+  // close a cycle. Throw std::invalid_argument if a task is not in the graph.
+  bool addEdge(Task<Tag>* from, Task<Tag>* to) {
+    beginIncremental_("addEdge");
+    Node_& x = node_(from, "addEdge");
+    Node_& y = node_(to, "addEdge");
+    if (from == to) return false;
+    if (from->downstreamTasks_.count(to) > 0) return true;
+    if (y.order < x.order && !reorder_(from, to, y.order, x.order)) {
+      return false;
+    }
+    from->addDownstreamTask(to);
+    y.upstreams.push_back(from);
+    dirty_.insert(from);
+    dirty_.insert(to);
+    frozen_ = false;
+    return true;
+  }
+  // Remove an edge if it exists. The topological order stays valid.
+  void removeEdge(Task<Tag>* from, Task<Tag>* to) {
+    if (from->downstreamTasks_.count(to) == 0) return;
+    if (incremental_) {
+      auto& upstreams = node_(to, "removeEdge").upstreams;
+      auto it = std::find(upstreams.begin(), upstreams.end(), from);
+      if (it != upstreams.end()) {
+        *it = upstreams.back();
+        upstreams.pop_back();
+      }
+      dirty_.insert(from);
+      dirty_.insert(to);
+    }
+    from->removeDownstreamTask(to);
+    frozen_ = false;
+  }
+  // Remove a task and all its edges. Throw std::invalid_argument if the task
+  // is not in the graph.
+  void removeTask(Task<Tag>* t) {
+    beginIncremental_("removeTask");
+    Node_& node = node_(t, "removeTask");
+    std::vector<Task<Tag>*> downstreams(t->downstreamTasks_.begin(),
+                                        t->downstreamTasks_.end());
+    for (auto d : downstreams) removeEdge(t, d);
+    std::vector<Task<Tag>*> upstreams(node.upstreams);
+    for (auto u : upstreams) removeEdge(u, t);
+    // Swap the last task of the tag into the slot of the removed one
+    int tag = detail::taskTag(t);
+    auto& bucket = tasksByTag_[tag];
+    bucket[node.slot] = bucket.back();
+    nodes_.at(bucket[node.slot]).slot = node.slot;
+    bucket.pop_back();
+    if (bucket.empty()) tasksByTag_.erase(tag);
+    nodes_.erase(t);
+    dirty_.erase(t);
+    taskCount_--;
+    frozen_ = false;
+  }
+  // Return the position of a task in the maintained topological order. A task
+  // is always positioned before its downstream tasks. Positions are unique
+  // but not dense.
+  int64_t topologicalPosition(Task<Tag>* t) {
+    beginIncremental_("topologicalPosition");
+    return node_(t, "topologicalPosition").order;
+  }
+  // Check the tasks edited since the last successful revalidation. The graph
+  // is acyclic by construction, so only the upstream counts of the dirty tasks
+  // are checked. Fall back to `validate()` if the graph was never edited.
+  std::pair<bool, std::string> revalidate(bool diagnostics = false) {
+    if (!incremental_) return validate(diagnostics);
+    bool isValid = true;
+    std::ostringstream os;
+    for (auto t : dirty_) {
+      int real = static_cast<int>(nodes_.at(t).upstreams.size());
+      if (t->upstreamCount() != real) {
+        isValid = false;
+        if (diagnostics) {
+          os << "Invalid upstream count for '" << t->id() << "@" << t
+             << "': claimed " << t->upstreamCount() << ", real " << real;
+        }
+      }
+    }
+    if (isValid) dirty_.clear();
+    return {isValid, os.str()};
+  }
+
+  //
+  // Analysis passes
+  //
+
+  // Compute the upward rank (a.k.a. the bottom level) of every task and store
+  // it as the task priority. The upward rank of a task is its cost plus the
+  // largest upward rank of its downstream tasks, i.e., the cost of the longest
+  // path from the task to a sink. Scheduling by this priority runs the tasks
+  // on the critical path first, as in HEFT.
+  //
+  // Cost is a functor like `double(const Task* t)` estimating the execution
+  // time of a task. The graph is frozen if not yet and shall be acyclic.
+  // Return the length of the critical path.
+  template <
+      typename Cost, typename T = Tag,
+      typename std::enable_if<detail::tag_traits<T>::priority, int>::type = 0>
+  double computeUpwardRanks(Cost cost) {
+    if (!frozen_) freeze();
+    std::vector<uint32_t> order = topologicalOrder();
+    if (order.size() != tasks_.size()) {
+      throw std::invalid_argument(
+          "TaskGraph::computeUpwardRanks: the task graph is cyclic");
+    }
+    std::vector<double> ranks(tasks_.size(), 0.0);
+    double criticalPath = 0.0;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+      double longest = 0.0;
+      for (auto j : downstreamIndices(*it)) {
+        longest = std::max(longest, ranks[j]);
+      }
+      Task<Tag>* t = tasks_[*it];
+      ranks[*it] = static_cast<double>(cost(t)) + longest;
+      t->setPriority(ranks[*it]);
+      criticalPath = std::max(criticalPath, ranks[*it]);
+    }
+    return criticalPath;
+  }
+  // The same as above, with unit cost for every task.
+  template <
+      typename T = Tag,
+      typename std::enable_if<detail::tag_traits<T>::priority, int>::type = 0>
+  double computeUpwardRanks() {
+    return computeUpwardRanks([](const Task<Tag>*) { return 1.0; });
+  }
+
+  // Build a coarser graph by fusing cheap tasks into `FusedTask`s, to cut the
+  // scheduling overhead of fine-grained graphs.
+  //
+  // The tasks are visited in topological order, and a task joins the cluster
+  // of its upstream tasks if they all belong to the same cluster, the cluster
+  // has the same tag, and the total estimated cost stays within `threshold`.
+  // This fuses linear chains and small fan-in clusters. A cluster only grows
+  // by tasks whose upstream tasks are all inside it, so no path leaves and
+  // re-enters a cluster, and the coarse graph is a DAG running every task
+  // after its upstream tasks. A fused task has the tag of its members and the
+  // highest priority among them.
+  //
+  // Cost is a functor like `double(const Task* t)` estimating the execution
+  // time of a task. The coarse graph owns the fused tasks, which refer to the
+  // tasks of this graph. This graph is frozen if not yet. Throw
+  // std::invalid_argument if the graph is cyclic or has subgraph tasks.
+  template <typename Cost>
+  TaskGraph coarsen(Cost cost, double threshold) {
+    if (!frozen_) freeze();
+    std::vector<uint32_t> order = topologicalOrder();
+    if (order.size() != tasks_.size()) {
+      throw std::invalid_argument("TaskGraph::coarsen: the task graph is cyclic");
+    }
+    // The cluster of each task, and the common cluster of the upstream tasks
+    // visited so far (kNone if none yet, kMixed if several)
+    const uint32_t kNone = std::numeric_limits<uint32_t>::max();
+    const uint32_t kMixed = kNone - 1;
+    std::vector<uint32_t> clusterOf(tasks_.size());
+    std::vector<uint32_t> upstreamCluster(tasks_.size(), kNone);
+    std::vector<std::vector<Task<Tag>*>> members;
+    std::vector<double> costs;
+    std::vector<int> tags;
+    for (auto i : order) {
+      Task<Tag>* t = tasks_[i];
+      if (t->subgraph()) {
+        throw std::invalid_argument("TaskGraph::coarsen: subgraph task '" +
+                                    t->id() + "' cannot be fused");
+      }
+      double c = static_cast<double>(cost(t));
+      uint32_t k = upstreamCluster[i];
+      if (k < kMixed && tags[k] == detail::taskTag(t) &&
+          costs[k] + c <= threshold) {
+        members[k].push_back(t);
+        costs[k] += c;
+      } else {
+        k = static_cast<uint32_t>(members.size());
+        members.push_back({t});
+        costs.push_back(c);
+        tags.push_back(detail::taskTag(t));
+      }
+      clusterOf[i] = k;
+      for (auto j : downstreamIndices(i)) {
+        uint32_t& u = upstreamCluster[j];
+        u = u == kNone || u == k ? k : kMixed;
+      }
+    }
+    TaskGraph coarse;
+    std::vector<Task<Tag>*> fused;
+    fused.reserve(members.size());
+    for (auto& m : members) {
+      fused.push_back(coarse.template emplaceTask<FusedTask<Tag>>(std::move(m)));
+    }
+    for (size_t i = 0; i < tasks_.size(); i++) {
+      for (auto j : downstreamIndices(i)) {
+        if (clusterOf[i] != clusterOf[j]) {
+          fused[clusterOf[i]]->addDownstreamTask(fused[clusterOf[j]]);
+        }
+      }
+    }
+    return coarse;
   }
 
   // Loop over all tasks
@@ -286,6 +1084,10 @@ struct TaskGraph {
   // Op is a functor like `void(Task* t)`
   template <typename Op>
   void foreach (Op op) const {
+    if (frozen_) {
+      for (auto t : tasks_) op(t);
+      return;
+    }
     for (auto& kv : tasksByTag_) {
       for (auto& t : kv.second) op(t);
     }
@@ -305,8 +1107,8 @@ struct TaskGraph {
   // Loop over tasks with specific tag
   //
   // Op is a functor like `void(Task* t)`
-  template <typename Op, typename std::enable_if<detail::tag_traits<Tag>::tag,
-                                                 int>::type = 0>
+  template <typename Op, typename T = Tag,
+            typename std::enable_if<detail::tag_traits<T>::tag, int>::type = 0>
   void foreachByTag(int tag, Op op) const {
     if (tasksByTag_.find(tag) == tasksByTag_.end()) return;
     for (auto t : tasksByTag_.at(tag)) {
@@ -325,12 +1127,19 @@ struct TaskGraph {
     }
   }
 
-  // Check if the task is valid
+  // Check if the task graph is valid
   //
   // The graph is valid if and only if the upstream count matches the real
   // upstream count and the graph is a DAG.
   //
-  std::pair<bool, std::string> validate(bool diagnostics = false) const {
+  // Validating a frozen graph is much cheaper: it works on flat arrays,
+  // reuses its scratch memory across calls, runs on `threadCount` threads
+  // (automatically chosen by the graph size if not positive), and reports a
+  // concrete cycle. Concurrent calls on the same graph are not allowed.
+  //
+  std::pair<bool, std::string> validate(bool diagnostics = false,
+                                        int threadCount = 0) const {
+    if (frozen_) return validateFrozen_(diagnostics, threadCount);
     std::unordered_map<Task<Tag>*, int> counts;
     foreach ([&counts](Task<Tag>* t) {
       if (counts.find(t) == counts.end()) counts[t] = 0;
@@ -450,8 +1259,390 @@ struct TaskGraph {
   }
 
 private:
+  size_t arenaSize() const { return arena_ ? arena_->size() : 0; }
+
+  // Incremental bookkeeping of a task
+  struct Node_ {
+    int64_t order;  // Position in the topological order
+    size_t slot;    // Position in tasksByTag_
+    uint64_t mark;  // Equal to searchMark_ if visited by the current search
+    std::vector<Task<Tag>*> upstreams;
+  };
+
+  void addTask_(Task<Tag>* t, int tag) {
+    auto& bucket = tasksByTag_[tag];
+    if (incremental_) {
+      if (!t->downstreamTasks().empty()) {
+        throw std::invalid_argument(
+            "TaskGraph::addTask: task '" + t->id() +
+            "' has edges, connect it with addEdge() instead");
+      }
+      nodes_[t] = Node_{nextOrder_++, bucket.size(), 0, {}};
+      dirty_.insert(t);
+    }
+    bucket.push_back(t);
+    taskCount_++;
+    frozen_ = false;
+  }
+  Node_& node_(Task<Tag>* t, const char* method) {
+    auto it = nodes_.find(t);
+    if (it == nodes_.end()) {
+      throw std::invalid_argument(std::string("TaskGraph::") + method +
+                                  ": task '" + t->id() +
+                                  "' is not in the graph");
+    }
+    return it->second;
+  }
+  // Index the graph for incremental mutation: collect the upstream tasks and
+  // compute an initial topological order with Kahn's algorithm. Tasks whose
+  // upstream count is wrong start dirty.
+  void beginIncremental_(const char* method) {
+    if (incremental_) return;
+    nodes_.clear();
+    nodes_.reserve(taskCount_);
+    for (auto& kv : tasksByTag_) {
+      for (size_t i = 0; i < kv.second.size(); i++) {
+        nodes_[kv.second[i]] = Node_{-1, i, 0, {}};
+      }
+    }
+    std::vector<Task<Tag>*> order;
+    order.reserve(taskCount_);
+    for (auto& kv : nodes_) {
+      for (auto d : kv.first->downstreamTasks()) {
+        node_(d, method).upstreams.push_back(kv.first);
+      }
+    }
+    for (auto& kv : nodes_) {
+      kv.second.mark = kv.second.upstreams.size();
+      if (kv.second.mark == 0) order.push_back(kv.first);
+    }
+    for (size_t head = 0; head < order.size(); head++) {
+      nodes_.at(order[head]).order = static_cast<int64_t>(head);
+      for (auto d : order[head]->downstreamTasks()) {
+        if (--nodes_.at(d).mark == 0) order.push_back(d);
+      }
+    }
+    if (order.size() < nodes_.size()) {
+      nodes_.clear();
+      throw std::invalid_argument(std::string("TaskGraph::") + method +
+                                  ": the task graph is cyclic");
+    }
+    dirty_.clear();
+    for (auto& kv : nodes_) {
+      if (kv.first->upstreamCount() !=
+          static_cast<int>(kv.second.upstreams.size())) {
+        dirty_.insert(kv.first);
+      }
+    }
+    nextOrder_ = static_cast<int64_t>(order.size());
+    searchMark_ = 0;
+    incremental_ = true;
+  }
+  // Restore the topological order before inserting the edge from -> to, where
+  // `to` is positioned at `lower` before `from` at `upper`. Only the tasks
+  // positioned in [lower, upper] may have to move: those reachable from `to`
+  // must follow those reaching `from`. Both sets are found by bounded
+  // searches, then they share their old positions in the new relative order.
+  // Return false if `from` is reachable from `to`, i.e., the edge closes a
+  // cycle.
+  bool reorder_(Task<Tag>* from, Task<Tag>* to, int64_t lower, int64_t upper) {
+    const uint64_t mark = ++searchMark_;
+    forward_.clear();
+    backward_.clear();
+    stack_.clear();
+    Node_& y = nodes_.at(to);
+    y.mark = mark;
+    forward_.emplace_back(lower, &y);
+    stack_.push_back(to);
+    while (!stack_.empty()) {
+      auto t = stack_.back();
+      stack_.pop_back();
+      for (auto d : t->downstreamTasks_) {
+        if (d == from) return false;
+        auto it = nodes_.find(d);
+        if (it == nodes_.end()) continue;
+        Node_& n = it->second;
+        if (n.order < upper && n.mark != mark) {
+          n.mark = mark;
+          forward_.emplace_back(n.order, &n);
+          stack_.push_back(d);
+        }
+      }
+    }
+    Node_& x = nodes_.at(from);
+    x.mark = mark;
+    backward_.emplace_back(upper, &x);
+    stack_.push_back(from);
+    while (!stack_.empty()) {
+      auto t = stack_.back();
+      stack_.pop_back();
+      for (auto u : nodes_.at(t).upstreams) {
+        Node_& n = nodes_.at(u);
+        if (n.order > lower && n.mark != mark) {
+          n.mark = mark;
+          backward_.emplace_back(n.order, &n);
+          stack_.push_back(u);
+        }
+      }
+    }
+    std::sort(forward_.begin(), forward_.end());
+    std::sort(backward_.begin(), backward_.end());
+    positions_.clear();
+    for (auto& p : backward_) positions_.push_back(p.first);
+    for (auto& p : forward_) positions_.push_back(p.first);
+    std::sort(positions_.begin(), positions_.end());
+    size_t i = 0;
+    for (auto& p : backward_) p.second->order = positions_[i++];
+    for (auto& p : forward_) p.second->order = positions_[i++];
+    return true;
+  }
+
+  // The same as `validate()`, but walks the CSR arrays with dense indices.
+  //
+  // The in-degrees and the topological order live in scratch arrays reused
+  // across calls, so a successful serial validation does not allocate. Kahn's
+  // algorithm runs level by level: the workers grab chunks of the current
+  // frontier, and append the tasks becoming ready to the shared order array
+  // to form the next frontier.
+  std::pair<bool, std::string> validateFrozen_(bool diagnostics,
+                                               int threadCount) const {
+    const size_t n = tasks_.size();
+    if (threadCount <= 0) {
+      threadCount = n < (1 << 16) ? 1
+                                  : static_cast<int>(
+                                        std::thread::hardware_concurrency());
+    }
+    threadCount = std::max(1, std::min<int>(threadCount, n / 1024 + 1));
+    std::atomic<int>* counts = scratchCounts_.get(n);
+    uint32_t* order = scratchOrder_.get(n);
+    detail::ValidationState state;
+    if (threadCount == 1) {
+      validateWorker_(0, 1, counts, order, state);
+    } else {
+      state.barrier.reset(threadCount);
+      std::vector<std::thread> threads;
+      for (int i = 1; i < threadCount; i++) {
+        threads.emplace_back([this, i, threadCount, counts, order, &state] {
+          validateWorker_(i, threadCount, counts, order, state);
+        });
+      }
+      validateWorker_(0, threadCount, counts, order, state);
+      for (auto& t : threads) t.join();
+    }
+    // Only the failure paths below allocate, for their diagnostics
+    if (!state.countsMatch) {
+      if (!diagnostics) return {false, ""};
+      std::ostringstream os;
+      for (size_t i = 0; i < n; i++) {
+        int real = counts[i].load(std::memory_order_relaxed);
+        if (tasks_[i]->upstreamCount() != real) {
+          os << "Invalid upstream count for '" << tasks_[i]->id() << "@"
+             << tasks_[i] << "': claimed " << tasks_[i]->upstreamCount()
+             << ", real " << real;
+        }
+      }
+      return {false, os.str()};
+    }
+    if (state.tail == 0) {
+      return {false, diagnostics ? "The task graph is cyclic: there exist no "
+                                   "source tasks."
+                                 : ""};
+    }
+    if (!state.hasSink) {
+      return {false, diagnostics ? "The task graph is cyclic: there exist no "
+                                   "sink tasks."
+                                 : ""};
+    }
+    if (state.tail < n) {
+      if (!diagnostics) return {false, ""};
+      std::ostringstream os;
+      os << "The task graph is cyclic: cycle [";
+      bool first = true;
+      for (auto i : findCycle_(counts)) {
+        os << (first ? (first = false, "'") : " -> '") << tasks_[i]->id()
+           << "@" << tasks_[i] << "'";
+      }
+      os << "] blocks " << n - state.tail << " tasks";
+      return {false, os.str()};
+    }
+    return {true, ""};
+  }
+
+  // The work of one thread in `validateFrozen_()`. Task indices and frontier
+  // chunks are partitioned among `threadCount` threads.
+  void validateWorker_(int id, int threadCount, std::atomic<int>* counts,
+                       uint32_t* order, detail::ValidationState& state) const {
+    const size_t n = tasks_.size();
+    const size_t first = n * id / threadCount;
+    const size_t last = n * (id + 1) / threadCount;
+    auto sync = [&state, threadCount] {
+      if (threadCount > 1) state.barrier.wait();
+    };
+    // Count the real in-degrees
+    for (size_t i = first; i < last; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+    sync();
+    const size_t e = targets_.size();
+    for (size_t k = e * id / threadCount; k < e * (id + 1) / threadCount; k++) {
+      counts[targets_[k]].fetch_add(1, std::memory_order_relaxed);
+    }
+    sync();
+    // Check the claimed upstream counts and collect the sources
+    bool countsMatch = true, hasSink = false;
+    for (size_t i = first; i < last; i++) {
+      int c = counts[i].load(std::memory_order_relaxed);
+      if (c != tasks_[i]->upstreamCount()) countsMatch = false;
+      if (offsets_[i] == offsets_[i + 1]) hasSink = true;
+      if (c == 0) order[state.tail.fetch_add(1)] = static_cast<uint32_t>(i);
+    }
+    if (!countsMatch) state.countsMatch = false;
+    if (hasSink) state.hasSink = true;
+    sync();
+    if (!state.countsMatch) return;
+    // Kahn's algorithm, one frontier at a time while the frontier is wide.
+    // Every level ends with two barriers: after the first one the order array
+    // is stable and everyone reads the same new frontier, after the second
+    // one the frontier can be grabbed again.
+    const size_t chunk = 256;
+    size_t begin = 0;
+    size_t end = state.tail.load();
+    sync();
+    while (threadCount > 1 && end - begin >= chunk * threadCount) {
+      for (;;) {
+        size_t c = state.cursor.fetch_add(chunk);
+        if (c >= end) break;
+        for (size_t k = c; k < std::min(c + chunk, end); k++) {
+          for (auto j : downstreamIndices(order[k])) {
+            if (counts[j].fetch_sub(1, std::memory_order_relaxed) == 1) {
+              order[state.tail.fetch_add(1)] = j;
+            }
+          }
+        }
+      }
+      sync();
+      begin = end;
+      end = state.tail.load();
+      if (id == 0) state.cursor.store(begin);
+      sync();
+    }
+    // Finish the narrow frontiers serially without any more barriers
+    if (id != 0) return;
+    size_t tail = end;
+    for (size_t k = begin; k < tail; k++) {
+      for (auto j : downstreamIndices(order[k])) {
+        if (counts[j].fetch_sub(1, std::memory_order_relaxed) == 1) {
+          order[tail++] = j;
+        }
+      }
+    }
+    state.tail.store(tail);
+  }
+
+  // Find a cycle among the tasks left with pending upstreams by Kahn's
+  // algorithm. Every such task has a pending upstream task, so walking the
+  // pending upstream edges backwards must run into a cycle.
+  std::vector<uint32_t> findCycle_(const std::atomic<int>* counts) const {
+    const size_t n = tasks_.size();
+    std::vector<std::vector<uint32_t>> upstreams(n);
+    uint32_t start = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (counts[i].load(std::memory_order_relaxed) <= 0) continue;
+      start = static_cast<uint32_t>(i);
+      for (auto j : downstreamIndices(i)) {
+        if (counts[j].load(std::memory_order_relaxed) > 0) {
+          upstreams[j].push_back(static_cast<uint32_t>(i));
+        }
+      }
+    }
+    std::vector<int> visited(n, -1);
+    std::vector<uint32_t> path;
+    uint32_t i = start;
+    while (visited[i] < 0) {
+      visited[i] = static_cast<int>(path.size());
+      path.push_back(i);
+      i = upstreams[i].front();
+    }
+    // The path walks backwards, reverse it into the edge direction
+    std::vector<uint32_t> cycle(path.begin() + visited[i], path.end());
+    std::reverse(cycle.begin(), cycle.end());
+    cycle.push_back(cycle.front());
+    return cycle;
+  }
+
   size_t taskCount_ = 0;
   std::unordered_map<int, std::vector<Task<Tag>*>> tasksByTag_;
+  // The CSR representation, valid only if frozen_ is true
+  bool frozen_ = false;
+  std::vector<Task<Tag>*> tasks_;
+  std::vector<size_t> offsets_;
+  std::vector<uint32_t> targets_;
+  // Scratch memory of `validate()`
+  mutable detail::ScratchArray<std::atomic<int>> scratchCounts_;
+  mutable detail::ScratchArray<uint32_t> scratchOrder_;
+  // The incremental state, valid only if incremental_ is true
+  bool incremental_ = false;
+  int64_t nextOrder_ = 0;
+  uint64_t searchMark_ = 0;
+  std::unordered_map<Task<Tag>*, Node_> nodes_;
+  std::unordered_set<Task<Tag>*> dirty_;
+  // The tasks created by `emplace()`, shared by the copies of the graph
+  std::shared_ptr<detail::Arena<Task<Tag>>> arena_;
+  // Scratch memory of `reorder_()`
+  std::vector<Task<Tag>*> stack_;
+  std::vector<std::pair<int64_t, Node_*>> forward_, backward_;
+  std::vector<int64_t> positions_;
+};
+
+/*
+ * A task owning a child TaskGraph.
+ *
+ * TaskGraphExecutor schedules it as one node of the parent graph: once it is
+ * ready, its child tasks are spliced into the same workers (no nested
+ * executor), and it finishes, releasing its downstream tasks, when its last
+ * child task finishes. So library-level graphs compose into application graphs
+ * without oversubscribing threads or flattening them up front. Subgraph tasks
+ * can be nested.
+ *
+ * The child graph shall be valid, it is frozen when expanded. Its tasks shall
+ * not belong to any other graph.
+ */
+template <typename Tag = void>
+struct SubgraphTask : Task<Tag> {
+  // Create a subgraph task with an identity and the task metadata (the tag
+  // and/or the priority).
+  template <typename... Args>
+  explicit SubgraphTask(std::string id, Args&&... args)
+      : Task<Tag>(std::forward<Args>(args)...), id_(std::move(id)) {
+    this->subgraph_ = &graph_;
+  }
+
+  // Query the child graph
+  TaskGraph<Tag>& graph() { return graph_; }
+
+  // Run the child graph serially in topological order. Only for other
+  // schedulers, TaskGraphExecutor never calls it.
+  bool progress() override {
+    if (!graph_.frozen()) graph_.freeze();
+    for (auto i : graph_.topologicalOrder()) {
+      Task<Tag>* t = graph_.taskAt(i);
+      while (!t->progress()) std::this_thread::yield();
+    }
+    pendingChildren_.store(0, std::memory_order_relaxed);
+    return true;
+  }
+  bool finished() const override {
+    return pendingChildren_.load(std::memory_order_acquire) == 0;
+  }
+  std::string id() const override { return id_; }
+
+private:
+  friend struct TaskGraphExecutor<Tag>;
+
+  std::string id_;
+  TaskGraph<Tag> graph_;
+  // Unfinished child tasks in the current run, nonzero before the first run
+  std::atomic<size_t> pendingChildren_{1};
 };
 
 }  // namespace cppkit
@@ -0,0 +1,1258 @@
+#ifndef CPPKIT_TASK_GRAPH_EXECUTOR_HPP
+#define CPPKIT_TASK_GRAPH_EXECUTOR_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "TaskGraph.hpp"
+#include "TaskGraphTrace.hpp"
+
+/*
+ * A parallel executor for TaskGraph.
+ *
+ * The executor owns a pool of worker threads, each with a Chase-Lev
+ * work-stealing deque. A worker runs the tasks in its own deque in LIFO order
+ * and steals from a random victim when its deque is empty. When a task
+ * finishes, the worker decrements the pending upstream count of each
+ * downstream task and pushes the ones becoming ready onto its own deque, so
+ * there is no shared ready queue on the hot path.
+ *
+ * Alternatively, tasks with priority metadata can be dispatched in priority
+ * order through a relaxed concurrent priority queue, and tasks with tags can
+ * be bound to dedicated (and pinned) worker pools.
+ */
+
+namespace cppkit {
+
+namespace taskgraph {
+// How the executor picks the next ready task
+enum class SchedulingPolicy {
+  // LIFO on the local deque, stealing from random victims when empty. This
+  // gives the best throughput and locality.
+  WorkStealing,
+  // Tasks with higher priority run first. The ordering is kept across threads
+  // by a relaxed multi-queue, so it is approximate with several workers. Only
+  // valid for tasks with priority metadata.
+  Priority,
+};
+
+// A group of workers dedicated to tasks of specific tags
+struct WorkerPool {
+  // Number of workers in the pool
+  int threadCount = 1;
+  // Tags of the tasks served by the pool. Tasks with tags not bound to any
+  // pool run wherever they become ready.
+  std::vector<int> tags;
+  // CPUs to pin the workers to, no pinning if empty. Worker `k` of the pool
+  // is pinned to `cpus[k % cpus.size()]`.
+  std::vector<int> cpus;
+  // Pin every worker to the whole `cpus` set instead of a single CPU, e.g.,
+  // to bind the pool to a NUMA node with `numaNodeCpus()`.
+  bool shareCpus = false;
+};
+
+// Global limits on the resources held by the running tasks, see
+// `taskgraph::Resources`. Unlimited by default.
+struct ResourceBudget {
+  int64_t memory = std::numeric_limits<int64_t>::max();
+  int ioSlots = std::numeric_limits<int>::max();
+
+  bool limited() const {
+    return memory != std::numeric_limits<int64_t>::max() ||
+           ioSlots != std::numeric_limits<int>::max();
+  }
+};
+
+// Options for creating a TaskGraphExecutor
+struct ExecutorOptions {
+  // Number of workers, use the hardware concurrency if not positive. Ignored
+  // if `pools` is not empty.
+  int threadCount = 0;
+  SchedulingPolicy policy = SchedulingPolicy::WorkStealing;
+  // Tag-affine worker pools, only for tasks with tags and work stealing. A
+  // ready task is handed to the pool of its tag. Workers steal within their
+  // pool first and from other pools only when they stay idle.
+  std::vector<WorkerPool> pools;
+  // Progress unfinished tasks (whose `progress()` returned false, e.g., ones
+  // waiting for asynchronous I/O or MPI requests) on a dedicated polling
+  // thread, so the workers never spin on a stalled task.
+  bool pollingThread = false;
+  // The longest sleep of the polling thread between two sweeps in which no
+  // task finishes, in microseconds. The sleep starts at 1us and doubles after
+  // every fruitless sweep.
+  int maxPollingBackoff = 1000;
+  // Record the worker, the timestamps and the steal source of every task
+  // execution, see `TaskGraphExecutor::trace()`.
+  bool tracing = false;
+  // Capacity of the trace ring buffer of every worker. Older events are
+  // overwritten when a run records more.
+  size_t traceCapacity = 1 << 16;
+  // Limits on the resources of the running tasks. A ready task declaring
+  // resources waits until they fit in what the running tasks leave, or until
+  // no task holds any if it needs more than the budget.
+  ResourceBudget budget;
+};
+
+// Return the CPUs of a NUMA node, empty if unknown.
+inline std::vector<int> numaNodeCpus(int node) {
+  std::vector<int> cpus;
+#if defined(__linux__)
+  // The cpulist is like "0-3,8-11"
+  std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) +
+                   "/cpulist");
+  int first = 0;
+  while (is >> first) {
+    int last = first;
+    if (is.peek() == '-') {
+      is.get();
+      is >> last;
+    }
+    for (int c = first; c <= last; c++) cpus.push_back(c);
+    if (is.peek() == ',') is.get();
+  }
+#endif
+  return cpus;
+}
+}  // namespace taskgraph
+
+namespace detail {
+
+// A xorshift64 generator, cheap enough for picking random victims
+inline uint64_t nextRandom(uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// Pin the calling thread to a set of CPUs. Return whether it succeeds.
+inline bool pinCurrentThread(const std::vector<int>& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto c : cpus) CPU_SET(c, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+// A FIFO queue for handing items to other threads, guarded by a mutex. The
+// size is mirrored in an atomic for cheap emptiness checks by idle threads.
+template <typename T>
+struct InjectionQueue {
+  void push(T* item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.push_back(item);
+    size_.store(items_.size(), std::memory_order_release);
+  }
+  // Pop the oldest item, return nullptr if empty.
+  T* pop() {
+    if (size_.load(std::memory_order_acquire) == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (items_.empty()) return nullptr;
+    T* item = items_.front();
+    items_.pop_front();
+    size_.store(items_.size(), std::memory_order_release);
+    return item;
+  }
+  bool empty() const { return size_.load(std::memory_order_acquire) == 0; }
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.clear();
+    size_.store(0, std::memory_order_release);
+  }
+
+private:
+  std::mutex mutex_;
+  std::deque<T*> items_;
+  std::atomic<size_t> size_{0};
+};
+
+// A lock-free work-stealing deque by Chase and Lev, with the memory orderings
+// of Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models",
+// PPoPP 2013.
+//
+// Only the owner thread can call `push` and `pop`, which work on the bottom
+// end. Any thread can call `steal`, which works on the top end. The ring
+// buffer grows on demand. Retired buffers are kept until the deque is
+// destroyed since concurrent thieves may still be reading them.
+template <typename T>
+struct WorkStealingDeque {
+  explicit WorkStealingDeque(int64_t capacity = 256) {
+    buffers_.emplace_back(new Buffer(capacity));
+    buffer_.store(buffers_.back().get(), std::memory_order_relaxed);
+  }
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  // Push an item onto the bottom. Owner only.
+  void push(T* item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Buffer* a = buffer_.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) a = grow(a, t, b);
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  // Pop an item from the bottom, return nullptr if empty. Owner only.
+  T* pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* a = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = a->get(b);
+    if (t == b) {
+      // The last item, race against thieves
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+  // Steal an item from the top, return nullptr if empty or losing the race.
+  T* steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Buffer* a = buffer_.load(std::memory_order_acquire);
+    T* item = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+  // Query whether the deque is empty. The result is only a hint when other
+  // threads are working on the deque.
+  bool empty() const {
+    return bottom_.load(std::memory_order_relaxed) <=
+           top_.load(std::memory_order_relaxed);
+  }
+  // Drop all items. Only callable when no other thread works on the deque.
+  void clear() {
+    top_.store(bottom_.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+  }
+
+private:
+  struct Buffer {
+    explicit Buffer(int64_t c) : capacity(c), items(new std::atomic<T*>[c]) {}
+    T* get(int64_t i) const {
+      return items[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    void put(int64_t i, T* item) {
+      items[i & (capacity - 1)].store(item, std::memory_order_relaxed);
+    }
+    int64_t capacity;  // Always a power of two
+    std::unique_ptr<std::atomic<T*>[]> items;
+  };
+
+  Buffer* grow(Buffer* a, int64_t t, int64_t b) {
+    buffers_.emplace_back(new Buffer(a->capacity * 2));
+    Buffer* na = buffers_.back().get();
+    for (int64_t i = t; i < b; i++) na->put(i, a->get(i));
+    buffer_.store(na, std::memory_order_release);
+    return na;
+  }
+
+  std::atomic<int64_t> top_{0};
+  // Keep the thief-side and the owner-side indices on separate cache lines
+  char padding_[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> bottom_{0};
+  std::atomic<Buffer*> buffer_{nullptr};
+  std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// A relaxed concurrent priority queue (the MultiQueue of Rihani, Sanders and
+// Dementiev, SPAA 2015). Items live in several locked binary heaps. Push goes
+// to a random heap, pop compares the tops of two random heaps and takes the
+// larger one. The popped item is among the top ones with high probability and
+// contention is spread over the heaps.
+template <typename T>
+struct PriorityMultiQueue {
+  explicit PriorityMultiQueue(int queueCount) : queues_(queueCount) {}
+
+  // Push an item with specific priority.
+  void push(T* item, double priority, uint64_t& rng) {
+    for (;;) {
+      Queue& q = queues_[nextRandom(rng) % queues_.size()];
+      std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+      if (!lock.owns_lock()) continue;
+      q.heap.emplace_back(priority, item);
+      std::push_heap(q.heap.begin(), q.heap.end(), Less());
+      q.publish();
+      return;
+    }
+  }
+  // Pop an item with (approximately) the highest priority, return nullptr if
+  // all heaps are empty.
+  T* pop(uint64_t& rng) {
+    const size_t n = queues_.size();
+    for (int attempt = 0; attempt < 8; attempt++) {
+      size_t i = nextRandom(rng) % n;
+      size_t j = n > 1 ? (i + 1 + nextRandom(rng) % (n - 1)) % n : i;
+      if (better(j, i)) std::swap(i, j);
+      if (queues_[i].size.load(std::memory_order_acquire) == 0) continue;
+      T* item = tryPop(queues_[i]);
+      if (item) return item;
+    }
+    // Fall back to a full scan so that no item is left behind
+    for (auto& q : queues_) {
+      if (q.size.load(std::memory_order_acquire) == 0) continue;
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.heap.empty()) continue;
+      return popLocked(q);
+    }
+    return nullptr;
+  }
+  // Drop all items. Only callable when no other thread works on the queue.
+  void clear() {
+    for (auto& q : queues_) {
+      q.heap.clear();
+      q.publish();
+    }
+  }
+
+private:
+  using Entry = std::pair<double, T*>;
+  struct Less {
+    bool operator()(const Entry& a, const Entry& b) const {
+      return a.first < b.first;
+    }
+  };
+  struct Queue {
+    // Publish the top priority and the size for lock-free peeking
+    void publish() {
+      size.store(heap.size(), std::memory_order_release);
+      top.store(heap.empty() ? -std::numeric_limits<double>::infinity()
+                             : heap.front().first,
+                std::memory_order_relaxed);
+    }
+    std::mutex mutex;
+    std::vector<Entry> heap;
+    std::atomic<size_t> size{0};
+    std::atomic<double> top{-std::numeric_limits<double>::infinity()};
+    char padding_[64];
+  };
+
+  // Check whether queue `a` looks better than queue `b` to pop from
+  bool better(size_t a, size_t b) const {
+    if (queues_[b].size.load(std::memory_order_relaxed) == 0) return true;
+    if (queues_[a].size.load(std::memory_order_relaxed) == 0) return false;
+    return queues_[a].top.load(std::memory_order_relaxed) >
+           queues_[b].top.load(std::memory_order_relaxed);
+  }
+  T* tryPop(Queue& q) {
+    std::unique_lock<std::mutex> lock(q.mutex, std::try_to_lock);
+    if (!lock.owns_lock() || q.heap.empty()) return nullptr;
+    return popLocked(q);
+  }
+  T* popLocked(Queue& q) {
+    std::pop_heap(q.heap.begin(), q.heap.end(), Less());
+    T* item = q.heap.back().second;
+    q.heap.pop_back();
+    q.publish();
+    return item;
+  }
+
+  std::vector<Queue> queues_;
+};
+
+// Ready tasks waiting for resources. The tasks with the least net memory
+// growth (see `taskgraph::Resources::freedMemory`), then with the highest
+// priority, are admitted first, and a task is skipped while it does not fit
+// so that smaller ones can fill the budget. Admission reserves the resources
+// of a task until `release()`.
+template <typename T>
+struct AdmissionQueue {
+  explicit AdmissionQueue(const taskgraph::ResourceBudget& budget)
+      : budget_(budget) {}
+
+  // Check whether a task needs to be admitted
+  static bool gated(const T* t) {
+    return !t->subgraph() &&
+           (t->resources().memory > 0 || t->resources().ioSlots > 0);
+  }
+
+  void push(T* t) {
+    const taskgraph::Resources& r = t->resources();
+    Key key(r.memory - r.freedMemory, -taskPriority(t));
+    std::lock_guard<std::mutex> lock(mutex_);
+    items_.emplace(key, t);
+    size_.store(items_.size(), std::memory_order_release);
+  }
+  // Admit the first waiting task fitting in the budget, return nullptr if
+  // none does.
+  T* pop() {
+    if (size_.load(std::memory_order_acquire) == 0) return nullptr;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = items_.begin(); it != items_.end(); ++it) {
+      const taskgraph::Resources& r = it->second->resources();
+      if (!fits(r)) continue;
+      T* t = it->second;
+      items_.erase(it);
+      size_.store(items_.size(), std::memory_order_release);
+      memory_ += r.memory;
+      ioSlots_ += r.ioSlots;
+      peakMemory_ = std::max(peakMemory_, memory_);
+      return t;
+    }
+    return nullptr;
+  }
+  // Return the resources of a finished task to the budget.
+  void release(const T* t) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    memory_ -= t->resources().memory;
+    ioSlots_ -= t->resources().ioSlots;
+  }
+  bool empty() const { return size_.load(std::memory_order_acquire) == 0; }
+  // Drop all waiting tasks and reservations. Only callable when no other
+  // thread works on the queue.
+  void clear() {
+    items_.clear();
+    size_.store(0, std::memory_order_relaxed);
+    memory_ = 0;
+    ioSlots_ = 0;
+    peakMemory_ = 0;
+  }
+  // Return the most memory reserved at once since the last `clear()`.
+  int64_t peakMemory() const { return peakMemory_; }
+
+private:
+  using Key = std::pair<int64_t, double>;
+
+  bool fits(const taskgraph::Resources& r) const {
+    bool memory = memory_ == 0 || r.memory <= budget_.memory - memory_;
+    bool ioSlots = ioSlots_ == 0 || r.ioSlots <= budget_.ioSlots - ioSlots_;
+    return memory && ioSlots;
+  }
+
+  taskgraph::ResourceBudget budget_;
+  std::mutex mutex_;
+  std::multimap<Key, T*> items_;
+  std::atomic<size_t> size_{0};
+  int64_t memory_ = 0;  // Reserved by the admitted tasks
+  int ioSlots_ = 0;
+  int64_t peakMemory_ = 0;
+};
+
+}  // namespace detail
+
+/*
+ * A snapshot of a frozen TaskGraph prepared for repeated execution, like an
+ * instantiated CUDA graph but on the CPU.
+ *
+ * Capturing copies the CSR edge arrays and precomputes the upstream counts and
+ * the source tasks, so relaunching it with `TaskGraphExecutor::run()` neither
+ * freezes nor walks the tag buckets of the graph: the pending counts live in
+ * one flat array which is reset by a single linear pass, and the sources are
+ * seeded from a precomputed list. This suits iterative solvers running the
+ * same DAG many times.
+ *
+ * The snapshot does not follow later edits of the graph. It relies on the
+ * dense task indices assigned at capture, so freezing the graph again (or
+ * another graph sharing its tasks) requires capturing again. The pending
+ * counts of the tasks themselves are not used when running a snapshot.
+ */
+template <typename Tag = void>
+struct ExecutableGraph {
+  using TaskType = Task<Tag>;
+
+  // Capture a graph, freezing it if not yet. Throw std::invalid_argument if a
+  // non-empty graph has no source tasks.
+  explicit ExecutableGraph(TaskGraph<Tag>& graph) {
+    if (!graph.frozen()) graph.freeze();
+    const size_t n = graph.taskCount();
+    auto tasks = graph.tasks();
+    tasks_.assign(tasks.begin(), tasks.end());
+    offsets_.reserve(n + 1);
+    offsets_.push_back(0);
+    targets_.reserve(graph.edgeCount());
+    upstreamCounts_.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      auto downstreams = graph.downstreamIndices(i);
+      targets_.insert(targets_.end(), downstreams.begin(), downstreams.end());
+      offsets_.push_back(targets_.size());
+      upstreamCounts_.push_back(tasks_[i]->upstreamCount());
+      if (upstreamCounts_.back() == 0) sources_.push_back(i);
+    }
+    if (n > 0 && sources_.empty()) {
+      throw std::invalid_argument(
+          "ExecutableGraph: the task graph has no source tasks");
+    }
+    pending_.reset(new std::atomic<int>[n]);
+  }
+  ExecutableGraph(const ExecutableGraph&) = delete;
+  ExecutableGraph& operator=(const ExecutableGraph&) = delete;
+
+  // Return how many tasks are captured.
+  size_t taskCount() const { return tasks_.size(); }
+  // Return the task with specific dense index.
+  TaskType* taskAt(size_t index) const { return tasks_[index]; }
+  // Return the dense indices of the downstream tasks of a task.
+  detail::Span<const uint32_t> downstreamIndices(size_t index) const {
+    return {targets_.data() + offsets_[index],
+            targets_.data() + offsets_[index + 1]};
+  }
+  // Return the dense indices of the source tasks.
+  detail::Span<const uint32_t> sources() const {
+    return {sources_.data(), sources_.data() + sources_.size()};
+  }
+
+  // Reset the pending counts for another run.
+  void reset() {
+    const size_t n = upstreamCounts_.size();
+    const int* counts = upstreamCounts_.data();
+    for (size_t i = 0; i < n; i++) {
+      pending_[i].store(counts[i], std::memory_order_relaxed);
+    }
+  }
+  // Notify a task that one of its upstream tasks is finished. Return whether
+  // the task becomes ready for schedule.
+  bool notifyUpstreamFinished(size_t index) {
+    return pending_[index].fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+private:
+  std::vector<TaskType*> tasks_;
+  std::vector<size_t> offsets_;
+  std::vector<uint32_t> targets_;
+  std::vector<int> upstreamCounts_;
+  std::vector<uint32_t> sources_;
+  std::unique_ptr<std::atomic<int>[]> pending_;
+};
+
+/*
+ * Execute a TaskGraph in parallel with work stealing.
+ *
+ * The executor keeps its worker threads alive across runs, so it is cheap to
+ * run the same graph (or different graphs) many times. The thread calling
+ * `run()` participates as worker 0, so an executor with `n` threads spawns
+ * `n - 1` extra threads.
+ *
+ * A task is executed by calling `progress()`. If it returns false, the task is
+ * progressed again later: by default it goes to a shared retry queue, which
+ * the workers only look at when they have no ready work (whatever the
+ * scheduling policy), and with
+ * `ExecutorOptions::pollingThread` it is handed to a polling thread, which
+ * progresses all unfinished tasks in batched sweeps with adaptive backoff.
+ * A `SubgraphTask` is not progressed but expanded: its child tasks run on the
+ * same workers.
+ *
+ * With `SchedulingPolicy::Priority`, the ready tasks are kept in a shared
+ * relaxed priority queue instead of the per-worker deques, and tasks with
+ * higher `priority()` are dispatched first.
+ *
+ * With worker pools (see `taskgraph::WorkerPool`), every tag is bound to a
+ * pool of (optionally pinned) workers, so tasks touching the same data
+ * partition stay on warm caches and local memory. The thread calling `run()`
+ * belongs to the first pool but is never pinned.
+ *
+ * With `ExecutorOptions::tracing`, every task execution is recorded, see
+ * TaskGraphTrace.hpp.
+ *
+ * With `ExecutorOptions::budget`, ready tasks declaring resources (see
+ * `Task::setResources()`) bypass the deques and wait in an admission queue,
+ * which dispatches them when their resources fit and prefers the tasks
+ * freeing memory, keeping the peak memory bounded. Resources are held until
+ * a task finishes, even when its `progress()` returns false.
+ */
+template <typename Tag = void>
+struct TaskGraphExecutor {
+  using TaskType = Task<Tag>;
+  using GraphType = TaskGraph<Tag>;
+  using ExecutableGraphType = ExecutableGraph<Tag>;
+
+  // Create an executor with `threadCount` workers. Use the hardware
+  // concurrency if `threadCount` is not positive.
+  explicit TaskGraphExecutor(int threadCount = 0)
+      : TaskGraphExecutor(makeOptions(threadCount)) {}
+  // Create an executor with specific options.
+  explicit TaskGraphExecutor(const taskgraph::ExecutorOptions& options)
+      : policy_(options.policy),
+        polling_(options.pollingThread),
+        maxPollingBackoff_(std::max(1, options.maxPollingBackoff)),
+        tracing_(options.tracing),
+        traceCapacity_(std::max<size_t>(1, options.traceCapacity)) {
+    if (policy_ == taskgraph::SchedulingPolicy::Priority &&
+        !detail::tag_traits<Tag>::priority) {
+      throw std::invalid_argument(
+          "TaskGraphExecutor: priority scheduling requires tasks with "
+          "priority");
+    }
+    int threadCount = options.threadCount;
+    if (threadCount <= 0) {
+      threadCount = static_cast<int>(std::thread::hardware_concurrency());
+      if (threadCount <= 0) threadCount = 1;
+    }
+    if (!options.pools.empty()) threadCount = initPools(options.pools);
+    for (int i = 0; i < threadCount; i++) {
+      workers_.emplace_back(new Worker(i));
+    }
+    for (size_t p = 0; p < pools_.size(); p++) {
+      for (auto i : pools_[p]->workers) workers_[i]->pool = static_cast<int>(p);
+    }
+    if (tracing_) rings_.resize(threadCount + (polling_ ? 1 : 0));
+    if (options.budget.limited()) {
+      admission_.reset(new detail::AdmissionQueue<TaskType>(options.budget));
+    }
+    if (policy_ == taskgraph::SchedulingPolicy::Priority) {
+      readyQueue_.reset(
+          new detail::PriorityMultiQueue<TaskType>(2 * threadCount));
+    }
+    for (int i = 1; i < threadCount; i++) {
+      workers_[i]->thread = std::thread([this, i] { workerMain(i); });
+    }
+    if (polling_) poller_ = std::thread([this] { pollerMain(); });
+  }
+  // Destroy the executor and join all worker threads.
+  ~TaskGraphExecutor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+    }
+    wakeup_.notify_all();
+    for (auto& w : workers_) {
+      if (w->thread.joinable()) w->thread.join();
+    }
+    if (poller_.joinable()) poller_.join();
+  }
+  TaskGraphExecutor(const TaskGraphExecutor&) = delete;
+  TaskGraphExecutor& operator=(const TaskGraphExecutor&) = delete;
+
+  // Return how many worker threads (including the caller of `run()`) are
+  // used by the executor.
+  int threadCount() const { return static_cast<int>(workers_.size()); }
+  // Return the scheduling policy of the executor.
+  taskgraph::SchedulingPolicy policy() const { return policy_; }
+
+  // Execute all tasks in the graph and block until they are finished.
+  //
+  // The graph shall be valid (see `TaskGraph::validate()`), otherwise the call
+  // may never return. The graph is frozen (if not yet) and reset before
+  // execution, and the workers walk its CSR edge arrays. If any task throws,
+  // the execution is aborted and the first exception is rethrown here. Only
+  // one thread can call `run()` at a time.
+  void run(GraphType& graph) {
+    if (!graph.frozen()) graph.freeze();
+    graph.reset();
+    if (graph.taskCount() == 0) return;
+    graph_ = &graph;
+    executable_ = nullptr;
+    if (admission_) admission_->clear();
+    if (tracing_) beginTrace(graph.taskCount());
+    // Seed the source tasks round-robin. The workers are parked now, the
+    // mutex in `launch()` publishes the deques to them.
+    int next = 0;
+    size_t sourceCount = 0;
+    for (auto t : graph.tasks()) {
+      if (t->upstreamCount() != 0) continue;
+      sourceCount++;
+      seed(t, next);
+    }
+    if (sourceCount == 0) {
+      throw std::invalid_argument(
+          "TaskGraphExecutor: the task graph has no source tasks");
+    }
+    launch(graph.taskCount());
+  }
+  // Execute a captured graph and block until all its tasks are finished. It
+  // is the cheap way to run the same graph many times, see `ExecutableGraph`.
+  void run(ExecutableGraphType& graph) {
+    graph.reset();
+    if (graph.taskCount() == 0) return;
+    graph_ = nullptr;
+    executable_ = &graph;
+    if (admission_) admission_->clear();
+    if (tracing_) beginTrace(graph.taskCount());
+    int next = 0;
+    for (auto i : graph.sources()) seed(graph.taskAt(i), next);
+    launch(graph.taskCount());
+  }
+
+  // Return the most memory reserved by running tasks at once in the last run,
+  // 0 without a budget.
+  int64_t peakMemory() const {
+    return admission_ ? admission_->peakMemory() : 0;
+  }
+
+  // Collect the trace of the last run. The executor shall be created with
+  // `ExecutorOptions::tracing`, and the graph of the last run shall be alive.
+  taskgraph::Trace trace() const {
+    taskgraph::Trace trace;
+    if (!tracing_) return trace;
+    trace.workerCount = static_cast<int>(rings_.size());
+    trace.duration = traceDuration_;
+    for (auto& ring : rings_) trace.dropped += ring.collect(trace.events);
+    const size_t n = graph_        ? graph_->taskCount()
+                     : executable_ ? executable_->taskCount()
+                                   : 0;
+    trace.taskIds.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      trace.taskIds.push_back(graph_ ? graph_->taskAt(i)->id()
+                                     : executable_->taskAt(i)->id());
+    }
+    return trace;
+  }
+
+private:
+  struct Worker {
+    explicit Worker(int id_)
+        : id(id_), rng(0x9E3779B97F4A7C15ull * (id_ + 1)) {}
+    int id;
+    int pool = -1;  // The pool of the worker, -1 without pools
+    detail::WorkStealingDeque<TaskType> deque;
+    std::thread thread;
+    uint64_t rng;  // State of the xorshift generator for victim selection
+    int source = -1;  // Where the last task came from, see TraceEvent::source
+  };
+
+  struct Pool {
+    std::vector<int> workers;
+    std::vector<int> cpus;
+    bool shareCpus = false;
+    detail::InjectionQueue<TaskType> inbox;  // Tasks handed from other pools
+  };
+
+  static taskgraph::ExecutorOptions makeOptions(int threadCount) {
+    taskgraph::ExecutorOptions options;
+    options.threadCount = threadCount;
+    return options;
+  }
+
+  // Hand a source task to its pool, or to the workers round-robin.
+  void seed(TaskType* t, int& next) {
+    if (admission_ && admission_->gated(t)) {
+      admission_->push(t);
+      return;
+    }
+    int pool = poolOf(t);
+    if (pool >= 0) {
+      pools_[pool]->inbox.push(t);
+      return;
+    }
+    schedule(*workers_[next], t);
+    next = (next + 1) % threadCount();
+  }
+
+  // Clear the trace buffers and mark all tasks ready at the start of a run.
+  void beginTrace(size_t taskCount) {
+    for (auto& ring : rings_) ring.reset(traceCapacity_);
+    auto readyTimes = readyTimes_.get(taskCount);
+    auto triggers = triggers_.get(taskCount);
+    for (size_t i = 0; i < taskCount; i++) {
+      readyTimes[i].store(0, std::memory_order_relaxed);
+      triggers[i].store(taskgraph::kNoTask, std::memory_order_relaxed);
+    }
+    traceStart_ = std::chrono::steady_clock::now();
+  }
+  // Return the nanoseconds since the start of the traced run.
+  int64_t traceTime() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - traceStart_)
+        .count();
+  }
+  // Progress a task, recording a trace event into the ring of `worker` if
+  // tracing.
+  bool progress(TaskType* t, int worker, int source) {
+    if (!tracing_) return t->progress();
+    // Child tasks are attributed to their top-level subgraph task
+    TaskType* top = t;
+    while (top->parent_) top = top->parent_;
+    taskgraph::TraceEvent e;
+    e.task = static_cast<uint32_t>(top->index());
+    e.trigger = triggers_.data()[e.task].load(std::memory_order_relaxed);
+    e.worker = worker;
+    e.source = source;
+    e.ready = readyTimes_.data()[e.task].load(std::memory_order_relaxed);
+    e.start = traceTime();
+    e.finished = false;
+    try {
+      e.finished = t->progress();
+    } catch (...) {
+      e.end = traceTime();
+      rings_[worker].push(e);
+      throw;
+    }
+    e.end = traceTime();
+    rings_[worker].push(e);
+    return e.finished;
+  }
+
+  // Wake up the workers on the seeded tasks and work until `taskCount` tasks
+  // are finished.
+  void launch(size_t taskCount) {
+    remaining_.store(taskCount, std::memory_order_relaxed);
+    aborted_.store(false, std::memory_order_relaxed);
+    error_ = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      activeWorkers_.store(threadCount() - 1 + (polling_ ? 1 : 0),
+                           std::memory_order_relaxed);
+      epoch_++;
+    }
+    wakeup_.notify_all();
+    runWorker(0);
+    while (activeWorkers_.load(std::memory_order_acquire) > 0) {
+      std::this_thread::yield();
+    }
+    if (tracing_) traceDuration_ = traceTime();
+    if (aborted_.load(std::memory_order_relaxed)) {
+      for (auto& w : workers_) w->deque.clear();
+      if (readyQueue_) readyQueue_->clear();
+      for (auto& p : pools_) p->inbox.clear();
+      sharedInbox_.clear();
+      pollingInbox_.clear();
+      if (admission_) admission_->clear();
+      std::rethrow_exception(error_);
+    }
+  }
+
+  // Create the pools and the tag-to-pool table, return the total number of
+  // workers.
+  int initPools(const std::vector<taskgraph::WorkerPool>& pools) {
+    if (!detail::tag_traits<Tag>::tag ||
+        policy_ != taskgraph::SchedulingPolicy::WorkStealing) {
+      throw std::invalid_argument(
+          "TaskGraphExecutor: worker pools require tasks with tags and the "
+          "work-stealing policy");
+    }
+    int threadCount = 0;
+    for (auto& options : pools) {
+      if (options.threadCount <= 0) {
+        throw std::invalid_argument(
+            "TaskGraphExecutor: a worker pool needs at least one thread");
+      }
+      std::unique_ptr<Pool> pool(new Pool);
+      for (int k = 0; k < options.threadCount; k++) {
+        pool->workers.push_back(threadCount++);
+      }
+      pool->cpus = options.cpus;
+      pool->shareCpus = options.shareCpus;
+      for (auto tag : options.tags) {
+        if (tag < 0) {
+          throw std::invalid_argument(
+              "TaskGraphExecutor: pool tags shall be non-negative");
+        }
+        if (static_cast<size_t>(tag) >= poolOfTag_.size()) {
+          poolOfTag_.resize(tag + 1, -1);
+        }
+        if (poolOfTag_[tag] < 0) {
+          poolOfTag_[tag] = static_cast<int>(pools_.size());
+        }
+      }
+      pools_.push_back(std::move(pool));
+    }
+    return threadCount;
+  }
+
+  // Return the pool bound to the tag of a task, -1 if none.
+  int poolOf(const TaskType* t) const {
+    if (poolOfTag_.empty()) return -1;
+    int tag = detail::taskTag(t);
+    if (tag < 0 || static_cast<size_t>(tag) >= poolOfTag_.size()) return -1;
+    return poolOfTag_[tag];
+  }
+
+  // Pin a spawned worker according to its pool.
+  void pinWorker(const Worker& w) {
+    if (w.pool < 0) return;
+    const Pool& p = *pools_[w.pool];
+    if (p.cpus.empty()) return;
+    if (p.shareCpus) {
+      detail::pinCurrentThread(p.cpus);
+    } else {
+      size_t k = std::find(p.workers.begin(), p.workers.end(), w.id) -
+                 p.workers.begin();
+      detail::pinCurrentThread({p.cpus[k % p.cpus.size()]});
+    }
+  }
+
+  // The main loop of spawned worker threads: park until a run starts.
+  void workerMain(int id) {
+    pinWorker(*workers_[id]);
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.wait(lock,
+                     [this, seen] { return shutdown_ || epoch_ != seen; });
+        if (shutdown_) return;
+        seen = epoch_;
+      }
+      runWorker(id);
+      activeWorkers_.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // The main loop of the polling thread: park until a run starts.
+  void pollerMain() {
+    uint64_t seen = 0;
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wakeup_.wait(lock,
+                     [this, seen] { return shutdown_ || epoch_ != seen; });
+        if (shutdown_) return;
+        seen = epoch_;
+      }
+      runPoller(rng);
+      activeWorkers_.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // Progress the unfinished tasks in sweeps until all tasks of the current
+  // run are finished. Sleep with exponential backoff while no task finishes.
+  void runPoller(uint64_t& rng) {
+    std::vector<TaskType*> pending;
+    int backoff = 0;
+    while (remaining_.load(std::memory_order_acquire) > 0 &&
+           !aborted_.load(std::memory_order_relaxed)) {
+      while (TaskType* t = pollingInbox_.pop()) pending.push_back(t);
+      bool progressed = false;
+      for (size_t i = 0; i < pending.size();) {
+        TaskType* t = pending[i];
+        bool finished = false;
+        try {
+          finished = progress(t, threadCount(), -1);
+        } catch (...) {
+          fail();
+          return;
+        }
+        if (!finished) {
+          i++;
+          continue;
+        }
+        pending[i] = pending.back();
+        pending.pop_back();
+        progressed = true;
+        finish(t, nullptr, rng);
+      }
+      if (progressed) {
+        backoff = 0;
+      } else {
+        backoff = std::min(backoff ? 2 * backoff : 1, maxPollingBackoff_);
+        std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+      }
+    }
+  }
+
+  // Execute tasks until all tasks of the current run are finished.
+  void runWorker(int id) {
+    Worker& w = *workers_[id];
+    int idle = 0;
+    while (remaining_.load(std::memory_order_acquire) > 0 &&
+           !aborted_.load(std::memory_order_relaxed)) {
+      // Retrying a task which stays unfinished counts as idle, so the
+      // workers back off when only stalled tasks remain
+      TaskType* t = nextTask(w, idle);
+      if (t && execute(w, t)) {
+        idle = 0;
+      } else if (++idle > 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  // Make a ready task available to the workers.
+  void schedule(Worker& w, TaskType* t) {
+    if (admission_ && admission_->gated(t)) {
+      admission_->push(t);
+      return;
+    }
+    if (readyQueue_) {
+      readyQueue_->push(t, detail::taskPriority(t), w.rng);
+      return;
+    }
+    int pool = poolOf(t);
+    if (pool >= 0 && pool != w.pool) {
+      pools_[pool]->inbox.push(t);
+    } else {
+      w.deque.push(t);
+    }
+  }
+
+  // Make a ready task available to the workers from a non-worker thread.
+  void scheduleShared(TaskType* t, uint64_t& rng) {
+    if (admission_ && admission_->gated(t)) {
+      admission_->push(t);
+      return;
+    }
+    if (readyQueue_) {
+      readyQueue_->push(t, detail::taskPriority(t), rng);
+      return;
+    }
+    int pool = poolOf(t);
+    if (pool >= 0) {
+      pools_[pool]->inbox.push(t);
+    } else {
+      sharedInbox_.push(t);
+    }
+  }
+
+  // Pick the next ready task for a worker, return nullptr if none is found.
+  // `idle` is how many times the worker has found nothing in a row. The origin
+  // of the task is left in `w.source`.
+  TaskType* nextTask(Worker& w, int idle) {
+    w.source = -1;
+    TaskType* t = nullptr;
+    if (admission_ && (t = admission_->pop())) {
+      // Hand the admitted task to its pool if it belongs to another one
+      int pool = poolOf(t);
+      if (pool < 0 || pool == w.pool) return t;
+      pools_[pool]->inbox.push(t);
+    }
+    if (readyQueue_) {
+      if ((t = readyQueue_->pop(w.rng))) return t;
+      return sharedInbox_.pop();
+    }
+    t = w.deque.pop();
+    if (t) {
+      w.source = w.id;
+      return t;
+    }
+    if (pools_.empty()) {
+      if ((t = steal(w))) return t;
+      return sharedInbox_.pop();
+    }
+    // Look in the own pool first, and other pools only when staying idle
+    Pool& own = *pools_[w.pool];
+    if ((t = own.inbox.pop())) return t;
+    if ((t = stealFrom(w, own.workers))) return t;
+    if ((t = sharedInbox_.pop())) return t;
+    if (idle <= 16) return nullptr;
+    const int n = static_cast<int>(pools_.size());
+    for (int k = 1; k < n; k++) {
+      Pool& p = *pools_[(w.pool + k) % n];
+      if ((t = p.inbox.pop())) return t;
+      if ((t = stealFrom(w, p.workers))) return t;
+    }
+    return nullptr;
+  }
+
+  // Try stealing a task from random victims in a pool.
+  TaskType* stealFrom(Worker& w, const std::vector<int>& victims) {
+    const size_t n = victims.size();
+    for (size_t i = 0; i < n; i++) {
+      int victim = victims[detail::nextRandom(w.rng) % n];
+      if (victim == w.id) continue;
+      TaskType* t = workers_[victim]->deque.steal();
+      if (t) {
+        w.source = victim;
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  // Try stealing a task from random victims.
+  TaskType* steal(Worker& w) {
+    int n = threadCount();
+    if (n == 1) return nullptr;
+    for (int i = 0; i < n; i++) {
+      int victim = static_cast<int>(detail::nextRandom(w.rng) % (n - 1));
+      if (victim >= w.id) victim++;
+      TaskType* t = workers_[victim]->deque.steal();
+      if (t) {
+        w.source = victim;
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  // Progress a task and release its downstream tasks once it is finished.
+  // Return false if the task is left unfinished.
+  bool execute(Worker& w, TaskType* t) {
+    if (t->subgraph_) {
+      try {
+        expand(w, static_cast<SubgraphTask<Tag>*>(t));
+      } catch (...) {
+        fail();
+      }
+      return true;
+    }
+    bool finished = false;
+    try {
+      finished = progress(t, w.id, w.source);
+    } catch (...) {
+      fail();
+      return true;
+    }
+    if (!finished) {
+      // Do not spin on the task, let the ready tasks go first. Even with
+      // priorities, since a task may wait on tasks of lower priority.
+      if (polling_) {
+        pollingInbox_.push(t);
+      } else {
+        sharedInbox_.push(t);
+      }
+      return false;
+    }
+    finish(t, &w, w.rng);
+    return true;
+  }
+
+  // Splice the child tasks of a subgraph task into the worker `w`. The
+  // subgraph task is released with its last child task, see `release()`.
+  void expand(Worker& w, SubgraphTask<Tag>* s) {
+    GraphType& g = s->graph_;
+    if (!g.frozen()) g.freeze();
+    size_t sourceCount = 0;
+    for (auto c : g.tasks()) {
+      c->reset();
+      c->parent_ = s;
+      if (c->upstreamCount() == 0) sourceCount++;
+    }
+    if (g.taskCount() == 0) {
+      s->pendingChildren_.store(0, std::memory_order_release);
+      release(s, &w, w.rng);
+      return;
+    }
+    if (sourceCount == 0) {
+      throw std::invalid_argument("TaskGraphExecutor: the child graph of '" +
+                                  s->id() + "' has no source tasks");
+    }
+    s->pendingChildren_.store(g.taskCount(), std::memory_order_relaxed);
+    for (auto c : g.tasks()) {
+      if (c->upstreamCount() == 0) schedule(w, c);
+    }
+  }
+
+  // Release the downstream tasks of a finished task, then return its
+  // resources, so that the admission queue sees all the tasks it releases.
+  void finish(TaskType* t, Worker* w, uint64_t& rng) {
+    release(t, w, rng);
+    if (admission_ && admission_->gated(t)) admission_->release(t);
+  }
+
+  // Release the downstream tasks of a finished task. The ready ones go to the
+  // worker `w`, or to the shared queues if `w` is nullptr.
+  void release(TaskType* t, Worker* w, uint64_t& rng) {
+    const int i = t->index();
+    if (TaskType* parent = t->parent_) {
+      GraphType& g = *parent->subgraph_;
+      for (auto j : g.downstreamIndices(i)) {
+        TaskType* d = g.taskAt(j);
+        if (d->notifyUpstreamFinished()) ready(d, i, w, rng);
+      }
+      auto s = static_cast<SubgraphTask<Tag>*>(parent);
+      if (s->pendingChildren_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(parent, w, rng);
+      }
+      return;
+    }
+    if (executable_) {
+      for (auto j : executable_->downstreamIndices(i)) {
+        if (executable_->notifyUpstreamFinished(j)) {
+          ready(executable_->taskAt(j), i, w, rng);
+        }
+      }
+    } else {
+      for (auto j : graph_->downstreamIndices(i)) {
+        TaskType* d = graph_->taskAt(j);
+        if (d->notifyUpstreamFinished()) ready(d, i, w, rng);
+      }
+    }
+    remaining_.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  // Schedule a task released by the task with index `trigger` from the worker
+  // `w`, or from a non-worker thread if `w` is nullptr.
+  void ready(TaskType* t, int trigger, Worker* w, uint64_t& rng) {
+    if (tracing_ && !t->parent_) {
+      readyTimes_.data()[t->index()].store(traceTime(),
+                                           std::memory_order_relaxed);
+      triggers_.data()[t->index()].store(static_cast<uint32_t>(trigger),
+                                         std::memory_order_relaxed);
+    }
+    if (w) {
+      schedule(*w, t);
+    } else {
+      scheduleShared(t, rng);
+    }
+  }
+
+  // Abort the current run with the exception being handled.
+  void fail() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!aborted_.load(std::memory_order_relaxed)) {
+      error_ = std::current_exception();
+      aborted_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  taskgraph::SchedulingPolicy policy_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  // The shared ready queue, only for priority scheduling
+  std::unique_ptr<detail::PriorityMultiQueue<TaskType>> readyQueue_;
+  // Ready tasks waiting for resources, only with a budget
+  std::unique_ptr<detail::AdmissionQueue<TaskType>> admission_;
+  // The tag-affine pools and the pool index of each tag (-1 if unbound)
+  std::vector<std::unique_ptr<Pool>> pools_;
+  std::vector<int> poolOfTag_;
+  // Tasks to retry or released by the polling thread
+  detail::InjectionQueue<TaskType> sharedInbox_;
+  // The polling thread and its incoming unfinished tasks
+  bool polling_;
+  int maxPollingBackoff_;
+  std::thread poller_;
+  detail::InjectionQueue<TaskType> pollingInbox_;
+  // The graph in the current run, either a TaskGraph or a captured one
+  GraphType* graph_ = nullptr;
+  ExecutableGraphType* executable_ = nullptr;
+  std::mutex mutex_;
+  std::condition_variable wakeup_;
+  uint64_t epoch_ = 0;
+  bool shutdown_ = false;
+  std::atomic<size_t> remaining_{0};
+  std::atomic<int> activeWorkers_{0};
+  std::atomic<bool> aborted_{false};
+  std::exception_ptr error_;
+  // The trace of the current run, one ring per worker plus the poller
+  bool tracing_;
+  size_t traceCapacity_;
+  std::vector<detail::TraceRing> rings_;
+  // When each task became ready and which task released it. They are handed
+  // over with the task through the queues, atomics only keep them race-free
+  // for the thread sanitizer.
+  detail::ScratchArray<std::atomic<int64_t>> readyTimes_;
+  detail::ScratchArray<std::atomic<uint32_t>> triggers_;
+  std::chrono::steady_clock::time_point traceStart_;
+  int64_t traceDuration_ = 0;
+};
+
+}  // namespace cppkit
+
+#endif
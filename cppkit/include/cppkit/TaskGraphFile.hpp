@@ -0,0 +1,319 @@
+#ifndef CPPKIT_TASK_GRAPH_FILE_HPP
+#define CPPKIT_TASK_GRAPH_FILE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "TaskGraph.hpp"
+
+/*
+ * Saving and loading the topology of a TaskGraph.
+ *
+ * `saveTaskGraph()` writes the edges, the tags, the priorities and the ids of
+ * the tasks of a graph in dense index order. The tasks themselves are not
+ * saved. After a restart, `loadTaskGraph()` rebuilds the graph from the file
+ * by rebinding every id to a live task, which skips whatever built the graph
+ * in the first place. `TaskGraphImage` maps a file read-only, so tools can
+ * also analyze a saved graph offline without any task objects.
+ *
+ * The file is a header followed by arrays, each aligned to 8 bytes and stored
+ * in the native byte order (a byte-order mark rejects foreign files):
+ *
+ *   offsets     uint64[taskCount + 1]   CSR offsets into `targets`
+ *   targets     uint32[edgeCount]       Dense indices of downstream tasks
+ *   tags        int32[taskCount]        If the graph has tags
+ *   priorities  float64[taskCount]      If the graph has priorities
+ *   idOffsets   uint64[taskCount + 1]   Offsets into `ids`
+ *   ids         char[idBytes]           Task ids, not null-terminated
+ */
+
+namespace cppkit {
+
+namespace detail {
+struct TaskGraphFileHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t taskCount;
+  uint64_t edgeCount;
+  uint64_t idBytes;
+
+  enum : uint32_t {
+    kByteOrder = 0x01020304,
+    kVersion = 1,
+    // Flags
+    kTags = 1,
+    kPriorities = 2,
+  };
+};
+
+inline const char* taskGraphFileMagic() { return "CPKTGRF"; }
+
+// Round up to a multiple of 8
+inline uint64_t align8(uint64_t n) { return (n + 7) & ~uint64_t(7); }
+}  // namespace detail
+
+// Save the topology of a graph, freezing it if not yet. Throw
+// std::invalid_argument if two tasks have the same id, and std::runtime_error
+// if the file cannot be written.
+template <typename Tag>
+void saveTaskGraph(TaskGraph<Tag>& graph, const std::string& path) {
+  using Header = detail::TaskGraphFileHeader;
+  if (!graph.frozen()) graph.freeze();
+  const size_t n = graph.taskCount();
+  std::vector<uint64_t> offsets(n + 1, 0), idOffsets(n + 1, 0);
+  std::vector<std::string> ids(n);
+  std::unordered_set<std::string> seen;
+  for (size_t i = 0; i < n; i++) {
+    ids[i] = graph.taskAt(i)->id();
+    if (!seen.insert(ids[i]).second) {
+      throw std::invalid_argument("saveTaskGraph: duplicate task id '" +
+                                  ids[i] + "'");
+    }
+    offsets[i + 1] = offsets[i] + graph.downstreamIndices(i).size();
+    idOffsets[i + 1] = idOffsets[i] + ids[i].size();
+  }
+
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, detail::taskGraphFileMagic(), 8);
+  header.byteOrder = Header::kByteOrder;
+  header.version = Header::kVersion;
+  header.flags =
+      (detail::tag_traits<Tag>::tag ? uint32_t(Header::kTags) : 0) |
+      (detail::tag_traits<Tag>::priority ? uint32_t(Header::kPriorities) : 0);
+  header.taskCount = n;
+  header.edgeCount = graph.edgeCount();
+  header.idBytes = idOffsets[n];
+
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  uint64_t size = 0;
+  auto put = [&](const void* data, uint64_t bytes) {
+    os.write(static_cast<const char*>(data), bytes);
+    size += bytes;
+  };
+  auto pad = [&] {
+    static const char zeros[8] = {};
+    put(zeros, detail::align8(size) - size);
+  };
+  put(&header, sizeof(header));
+  put(offsets.data(), offsets.size() * sizeof(uint64_t));
+  for (size_t i = 0; i < n; i++) {
+    auto targets = graph.downstreamIndices(i);
+    put(targets.begin(), targets.size() * sizeof(uint32_t));
+  }
+  pad();
+  if (detail::tag_traits<Tag>::tag) {
+    std::vector<int32_t> tags(n);
+    for (size_t i = 0; i < n; i++) tags[i] = detail::taskTag(graph.taskAt(i));
+    put(tags.data(), n * sizeof(int32_t));
+    pad();
+  }
+  if (detail::tag_traits<Tag>::priority) {
+    std::vector<double> priorities(n);
+    for (size_t i = 0; i < n; i++) {
+      priorities[i] = detail::taskPriority(graph.taskAt(i));
+    }
+    put(priorities.data(), n * sizeof(double));
+  }
+  put(idOffsets.data(), idOffsets.size() * sizeof(uint64_t));
+  for (auto& id : ids) put(id.data(), id.size());
+  pad();
+  if (!os.flush()) {
+    throw std::runtime_error("saveTaskGraph: failed to write '" + path + "'");
+  }
+}
+
+/*
+ * A read-only view of a saved graph, mapped into memory. Opening it costs a
+ * validation pass over the offsets, not a parse.
+ */
+struct TaskGraphImage {
+  // Map a file saved by `saveTaskGraph()`. Throw std::runtime_error if it
+  // cannot be read or is malformed.
+  explicit TaskGraphImage(const std::string& path) : path_(path) {
+#if defined(__unix__)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) fail(std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      fail(std::strerror(errno));
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (p == MAP_FAILED) fail(std::strerror(errno));
+      data_ = static_cast<const char*>(p);
+      mapped_ = true;
+    } else {
+      ::close(fd);
+    }
+#else
+    std::ifstream is(path, std::ios::binary);
+    if (!is) fail("cannot open");
+    buffer_.assign(std::istreambuf_iterator<char>(is),
+                   std::istreambuf_iterator<char>());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+    try {
+      parse();
+    } catch (...) {
+      unmap();
+      throw;
+    }
+  }
+  ~TaskGraphImage() { unmap(); }
+  TaskGraphImage(const TaskGraphImage&) = delete;
+  TaskGraphImage& operator=(const TaskGraphImage&) = delete;
+
+  // Return how many tasks are saved.
+  size_t taskCount() const { return header_->taskCount; }
+  // Return how many edges are saved.
+  size_t edgeCount() const { return header_->edgeCount; }
+  // Check whether the tags or the priorities of the tasks are saved.
+  bool hasTags() const { return tags_ != nullptr; }
+  bool hasPriorities() const { return priorities_ != nullptr; }
+  // Return the dense indices of the downstream tasks of a task.
+  detail::Span<const uint32_t> downstreamIndices(size_t index) const {
+    return {targets_ + offsets_[index], targets_ + offsets_[index + 1]};
+  }
+  // Return the tag of a task, 0 if tags are not saved.
+  int tag(size_t index) const { return tags_ ? tags_[index] : 0; }
+  // Return the priority of a task, 0 if priorities are not saved.
+  double priority(size_t index) const {
+    return priorities_ ? priorities_[index] : 0.0;
+  }
+  // Return the id of a task.
+  std::string id(size_t index) const {
+    return std::string(ids_ + idOffsets_[index],
+                       idOffsets_[index + 1] - idOffsets_[index]);
+  }
+
+private:
+  using Header = detail::TaskGraphFileHeader;
+
+  [[noreturn]] void fail(const std::string& reason) const {
+    throw std::runtime_error("TaskGraphImage: '" + path_ + "': " + reason);
+  }
+
+  void unmap() {
+#if defined(__unix__)
+    if (mapped_) ::munmap(const_cast<char*>(data_), size_);
+    mapped_ = false;
+#endif
+  }
+
+  // Take `count` elements of T at the cursor, then align the cursor.
+  template <typename T>
+  const T* take(uint64_t& cursor, uint64_t count) {
+    if (count > (size_ - cursor) / sizeof(T)) fail("truncated file");
+    const T* p = reinterpret_cast<const T*>(data_ + cursor);
+    cursor = detail::align8(cursor + count * sizeof(T));
+    cursor = std::min<uint64_t>(cursor, size_);
+    return p;
+  }
+
+  void parse() {
+    uint64_t cursor = 0;
+    header_ = take<Header>(cursor, 1);
+    if (std::memcmp(header_->magic, detail::taskGraphFileMagic(), 8) != 0) {
+      fail("not a task graph file");
+    }
+    if (header_->byteOrder != Header::kByteOrder) fail("foreign byte order");
+    if (header_->version != Header::kVersion) fail("unsupported version");
+    const uint64_t n = header_->taskCount;
+    if (n >= std::numeric_limits<uint32_t>::max()) fail("too many tasks");
+    offsets_ = take<uint64_t>(cursor, n + 1);
+    targets_ = take<uint32_t>(cursor, header_->edgeCount);
+    if (header_->flags & Header::kTags) tags_ = take<int32_t>(cursor, n);
+    if (header_->flags & Header::kPriorities) {
+      priorities_ = take<double>(cursor, n);
+    }
+    idOffsets_ = take<uint64_t>(cursor, n + 1);
+    ids_ = take<char>(cursor, header_->idBytes);
+    // Check the offsets and the targets once, so accessors need not
+    if (offsets_[0] != 0 || offsets_[n] != header_->edgeCount ||
+        idOffsets_[0] != 0 || idOffsets_[n] != header_->idBytes) {
+      fail("corrupt offsets");
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      if (offsets_[i] > offsets_[i + 1] || idOffsets_[i] > idOffsets_[i + 1]) {
+        fail("corrupt offsets");
+      }
+    }
+    for (uint64_t e = 0; e < header_->edgeCount; e++) {
+      if (targets_[e] >= n) fail("corrupt edges");
+    }
+  }
+
+  std::string path_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+#if !defined(__unix__)
+  std::vector<char> buffer_;
+#endif
+  const Header* header_ = nullptr;
+  const uint64_t* offsets_ = nullptr;
+  const uint32_t* targets_ = nullptr;
+  const int32_t* tags_ = nullptr;
+  const double* priorities_ = nullptr;
+  const uint64_t* idOffsets_ = nullptr;
+  const char* ids_ = nullptr;
+};
+
+// Add the saved tasks into a graph, rebinding every id to the task returned
+// by `lookup(id)`, and connect them as saved. The tags and the priorities of
+// the tasks are set to the saved ones if both the file and the graph have
+// them. The tasks shall have no edges yet. The graph is frozen afterwards,
+// but the dense indices may differ from the saved ones. Throw
+// std::invalid_argument if `lookup` returns nullptr.
+template <typename Tag, typename Lookup>
+void loadTaskGraph(const TaskGraphImage& image, TaskGraph<Tag>& graph,
+                   Lookup&& lookup) {
+  const size_t n = image.taskCount();
+  std::vector<Task<Tag>*> tasks(n);
+  for (size_t i = 0; i < n; i++) {
+    tasks[i] = lookup(image.id(i));
+    if (!tasks[i]) {
+      throw std::invalid_argument("loadTaskGraph: no task with id '" +
+                                  image.id(i) + "'");
+    }
+    if (image.hasTags()) detail::setTaskTag(tasks[i], image.tag(i));
+    if (image.hasPriorities()) {
+      detail::setTaskPriority(tasks[i], image.priority(i));
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    for (auto j : image.downstreamIndices(i)) {
+      tasks[i]->addDownstreamTask(tasks[j]);
+    }
+  }
+  for (auto t : tasks) graph.addTask(t);
+  graph.freeze();
+}
+
+}  // namespace cppkit
+
+#endif
@@ -0,0 +1,381 @@
+#ifndef CPPKIT_TASK_GRAPH_PARTITION_HPP
+#define CPPKIT_TASK_GRAPH_PARTITION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "TaskGraph.hpp"
+
+/*
+ * Running one TaskGraph across several processes.
+ *
+ * Every process builds the same graph. `partitionGraph()` splits it into k
+ * parts with few cut edges, and every process wraps its own part into a
+ * `PartitionedGraph`, whose local graph runs on an ordinary TaskGraphExecutor.
+ * Finishing a task with downstream tasks in other parts sends a completion
+ * message over a `Transport`, and each remote upstream task is represented
+ * locally by a proxy task which finishes when its message arrives.
+ */
+
+namespace cppkit {
+
+namespace taskgraph {
+
+// Options of `partitionGraph()`
+struct PartitionOptions {
+  // Rounds of label propagation at most
+  int iterations = 10;
+  // A part may hold up to (1 + imbalance) * taskCount / k tasks
+  double imbalance = 0.05;
+};
+
+// Delivers task completions between the parts of a graph, one endpoint per
+// part. `send()` may be called concurrently, `receive()` is called by one
+// thread at a time.
+struct Transport {
+  virtual ~Transport() = default;
+  // Notify part `to` that the task with dense index `task` is finished.
+  virtual void send(int to, uint32_t task) = 0;
+  // Append the completions received so far to `tasks` without blocking.
+  virtual void receive(std::vector<uint32_t>& tasks) = 0;
+};
+
+#if defined(__unix__)
+// A transport over Unix domain datagram sockets, for processes on one node.
+// Part `rank` receives on the socket `directory/rank`.
+struct UnixSocketTransport : Transport {
+  UnixSocketTransport(const std::string& directory, int rank)
+      : directory_(directory), path_(socketPath(directory, rank)) {
+    fd_ = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd_ < 0) fail("socket");
+    sockaddr_un addr = address(path_);
+    ::unlink(path_.c_str());
+    if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      ::close(fd_);
+      fail("bind");
+    }
+  }
+  ~UnixSocketTransport() override {
+    ::close(fd_);
+    ::unlink(path_.c_str());
+  }
+  UnixSocketTransport(const UnixSocketTransport&) = delete;
+  UnixSocketTransport& operator=(const UnixSocketTransport&) = delete;
+
+  // Send a completion. Wait for a peer which is not bound yet or whose
+  // receive buffer is full, and throw std::runtime_error after 10 seconds.
+  void send(int to, uint32_t task) override {
+    sockaddr_un addr = address(socketPath(directory_, to));
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (::sendto(fd_, &task, sizeof(task), 0,
+                    reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+      if (errno != ENOENT && errno != ECONNREFUSED && errno != EAGAIN &&
+          errno != ENOBUFS && errno != EINTR) {
+        fail("sendto");
+      }
+      if (std::chrono::steady_clock::now() > deadline) fail("sendto");
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  void receive(std::vector<uint32_t>& tasks) override {
+    uint32_t task;
+    for (;;) {
+      ssize_t n = ::recv(fd_, &task, sizeof(task), MSG_DONTWAIT);
+      if (n == sizeof(task)) {
+        tasks.push_back(task);
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+      } else {
+        fail("recv");
+      }
+    }
+  }
+
+private:
+  static std::string socketPath(const std::string& directory, int rank) {
+    return directory + "/" + std::to_string(rank);
+  }
+  static sockaddr_un address(const std::string& path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      throw std::invalid_argument("UnixSocketTransport: path '" + path +
+                                  "' is too long");
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+  }
+  void fail(const char* call) const {
+    throw std::runtime_error("UnixSocketTransport: " + std::string(call) +
+                             " on '" + path_ + "' failed: " +
+                             std::strerror(errno));
+  }
+
+  std::string directory_;
+  std::string path_;
+  int fd_ = -1;
+};
+#endif
+
+}  // namespace taskgraph
+
+// Split a graph into k parts minimizing the cut edges, return the part of
+// every task by dense index. The graph is frozen if not yet.
+//
+// The initial parts are contiguous ranges of a topological order, or whole
+// tags (the largest first into the smallest part) if the tasks have at least
+// k tags. Then label propagation moves every task to the part most of its
+// neighbors (upstream and downstream) are in, as long as that part stays
+// within the balance bound, until no task moves.
+template <typename Tag>
+std::vector<int> partitionGraph(
+    TaskGraph<Tag>& graph, int k,
+    const taskgraph::PartitionOptions& options = taskgraph::PartitionOptions()) {
+  if (k <= 0) {
+    throw std::invalid_argument("partitionGraph: k shall be positive");
+  }
+  if (!graph.frozen()) graph.freeze();
+  const size_t n = graph.taskCount();
+  std::vector<uint32_t> order = graph.topologicalOrder();
+  if (order.size() != n) {
+    throw std::invalid_argument("partitionGraph: the task graph is cyclic");
+  }
+  std::vector<int> parts(n);
+  std::vector<size_t> sizes(k, 0);
+  std::unordered_map<int, size_t> tagSizes;
+  for (size_t i = 0; i < n; i++) tagSizes[detail::taskTag(graph.taskAt(i))]++;
+  if (tagSizes.size() >= static_cast<size_t>(k)) {
+    std::vector<std::pair<size_t, int>> bySize;  // (size, tag)
+    for (auto& kv : tagSizes) bySize.emplace_back(kv.second, kv.first);
+    std::sort(bySize.rbegin(), bySize.rend());
+    std::unordered_map<int, int> partOfTag;
+    for (auto& p : bySize) {
+      int part = static_cast<int>(std::min_element(sizes.begin(), sizes.end()) -
+                                  sizes.begin());
+      sizes[part] += p.first;
+      partOfTag[p.second] = part;
+    }
+    for (size_t i = 0; i < n; i++) {
+      parts[i] = partOfTag[detail::taskTag(graph.taskAt(i))];
+    }
+  } else {
+    for (size_t r = 0; r < n; r++) {
+      parts[order[r]] = static_cast<int>(r * k / n);
+      sizes[parts[order[r]]]++;
+    }
+  }
+  // The upstream edges in CSR form
+  std::vector<size_t> offsets(n + 1, 0);
+  for (size_t i = 0; i < n; i++) {
+    for (auto j : graph.downstreamIndices(i)) offsets[j + 1]++;
+  }
+  for (size_t i = 0; i < n; i++) offsets[i + 1] += offsets[i];
+  std::vector<uint32_t> upstreams(offsets.back());
+  std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+  for (size_t i = 0; i < n; i++) {
+    for (auto j : graph.downstreamIndices(i)) {
+      upstreams[fill[j]++] = static_cast<uint32_t>(i);
+    }
+  }
+  const size_t bound = static_cast<size_t>(
+      std::max(1.0, (1.0 + options.imbalance) * n / k + 1));
+  std::vector<int> counts(k, 0);
+  for (int round = 0; round < options.iterations; round++) {
+    size_t moves = 0;
+    for (auto i : order) {
+      auto count = [&](uint32_t j) { counts[parts[j]]++; };
+      for (auto j : graph.downstreamIndices(i)) count(j);
+      for (size_t e = offsets[i]; e < offsets[i + 1]; e++) count(upstreams[e]);
+      int best = parts[i];
+      for (int p = 0; p < k; p++) {
+        if (counts[p] > counts[best] && sizes[p] < bound) best = p;
+      }
+      std::fill(counts.begin(), counts.end(), 0);
+      if (best == parts[i]) continue;
+      sizes[parts[i]]--;
+      sizes[best]++;
+      parts[i] = best;
+      moves++;
+    }
+    if (moves == 0) break;
+  }
+  return parts;
+}
+
+// Count the edges between different parts.
+template <typename Tag>
+size_t cutEdgeCount(const TaskGraph<Tag>& graph, const std::vector<int>& parts) {
+  size_t cut = 0;
+  for (size_t i = 0; i < graph.taskCount(); i++) {
+    for (auto j : graph.downstreamIndices(i)) cut += parts[i] != parts[j];
+  }
+  return cut;
+}
+
+/*
+ * One part of a partitioned graph, for the process running that part.
+ *
+ * `graph()` is a local graph to run with TaskGraphExecutor. It holds a
+ * wrapper of every task in the part, which sends a completion to the parts
+ * of its remote downstream tasks when the task finishes, and a proxy of every
+ * remote upstream task, which finishes when the completion arrives. A proxy
+ * waits without blocking a worker, so an executor with a polling thread
+ * suits it best.
+ *
+ * Every process shall build the same graph (the same dense indices) and run
+ * its part the same number of times. Completions are counted, so a part may
+ * run ahead into the next run before a slower part finishes the current one.
+ */
+template <typename Tag = void>
+struct PartitionedGraph {
+  // Wrap part `rank` of a frozen graph. `parts` is the part of every task, as
+  // returned by `partitionGraph()`.
+  PartitionedGraph(TaskGraph<Tag>& graph, const std::vector<int>& parts,
+                   int rank, taskgraph::Transport& transport)
+      : transport_(transport),
+        taskCount_(parts.size()),
+        received_(new std::atomic<uint64_t>[parts.size()]) {
+    if (!graph.frozen() || parts.size() != graph.taskCount()) {
+      throw std::invalid_argument(
+          "PartitionedGraph: the graph shall be frozen and partitioned");
+    }
+    const size_t n = graph.taskCount();
+    std::vector<Task<Tag>*> local(n, nullptr);
+    for (size_t i = 0; i < n; i++) {
+      received_[i].store(0, std::memory_order_relaxed);
+      if (parts[i] != rank) continue;
+      std::vector<int> targets;
+      for (auto j : graph.downstreamIndices(i)) {
+        if (parts[j] != rank &&
+            std::find(targets.begin(), targets.end(), parts[j]) ==
+                targets.end()) {
+          targets.push_back(parts[j]);
+        }
+      }
+      local[i] = graph_.template emplaceTask<LocalTask>(
+          this, graph.taskAt(i), static_cast<uint32_t>(i), std::move(targets));
+    }
+    for (size_t i = 0; i < n; i++) {
+      for (auto j : graph.downstreamIndices(i)) {
+        if (parts[j] != rank) continue;
+        if (!local[i]) {
+          local[i] = graph_.template emplaceTask<RemoteTask>(
+              this, graph.taskAt(i), static_cast<uint32_t>(i));
+          remoteTaskCount_++;
+        }
+        local[i]->addDownstreamTask(local[j]);
+      }
+    }
+  }
+  PartitionedGraph(const PartitionedGraph&) = delete;
+  PartitionedGraph& operator=(const PartitionedGraph&) = delete;
+
+  // Query the local graph to run
+  TaskGraph<Tag>& graph() { return graph_; }
+  // Query how many proxies of remote upstream tasks are in the local graph
+  size_t remoteTaskCount() const { return remoteTaskCount_; }
+
+private:
+  // A task of this part, telling the other parts when it finishes
+  struct LocalTask final : Task<Tag> {
+    LocalTask(PartitionedGraph* owner, Task<Tag>* task, uint32_t index,
+              std::vector<int> targets)
+        : owner_(owner),
+          task_(task),
+          global_(index),
+          targets_(std::move(targets)) {
+      detail::setTaskTag<Tag>(this, detail::taskTag(task));
+      detail::setTaskPriority<Tag>(this, detail::taskPriority(task));
+    }
+    bool progress() override {
+      if (!task_->progress()) return false;
+      for (auto to : targets_) owner_->transport_.send(to, global_);
+      return true;
+    }
+    bool finished() const override { return task_->finished(); }
+    std::string id() const override { return task_->id(); }
+
+    PartitionedGraph* owner_;
+    Task<Tag>* task_;
+    uint32_t global_;  // Dense index in the whole graph
+    std::vector<int> targets_;
+  };
+
+  // A proxy of a task in another part
+  struct RemoteTask final : Task<Tag> {
+    RemoteTask(PartitionedGraph* owner, Task<Tag>* task, uint32_t index)
+        : owner_(owner), task_(task), global_(index) {
+      detail::setTaskTag<Tag>(this, detail::taskTag(task));
+      detail::setTaskPriority<Tag>(this, detail::taskPriority(task));
+    }
+    bool progress() override {
+      if (done_) {  // A new run waits for one more completion
+        expected_++;
+        done_ = false;
+      }
+      owner_->pump();
+      done_ = owner_->received_[global_].load(std::memory_order_acquire) >=
+              expected_;
+      return done_;
+    }
+    bool finished() const override { return done_; }
+    std::string id() const override { return "remote:" + task_->id(); }
+
+    PartitionedGraph* owner_;
+    Task<Tag>* task_;
+    uint32_t global_;  // Dense index in the whole graph
+    uint64_t expected_ = 0;  // Completions needed to finish the current run
+    bool done_ = true;
+  };
+
+  // Drain the transport into the completion counts. Only one thread drains at
+  // a time, the others go on with their work.
+  void pump() {
+    std::unique_lock<std::mutex> lock(pumpMutex_, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    inbox_.clear();
+    transport_.receive(inbox_);
+    for (auto i : inbox_) {
+      if (i >= taskCount_) {
+        throw std::runtime_error(
+            "PartitionedGraph: received the completion of unknown task " +
+            std::to_string(i));
+      }
+      received_[i].fetch_add(1, std::memory_order_release);
+    }
+  }
+
+  taskgraph::Transport& transport_;
+  size_t taskCount_;  // Tasks in the whole graph
+  // Completions received per task of the whole graph
+  std::unique_ptr<std::atomic<uint64_t>[]> received_;
+  TaskGraph<Tag> graph_;
+  size_t remoteTaskCount_ = 0;
+  std::mutex pumpMutex_;
+  std::vector<uint32_t> inbox_;
+};
+
+}  // namespace cppkit
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef CPPKIT_TASK_GRAPH_TRACE_HPP
+#define CPPKIT_TASK_GRAPH_TRACE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * Execution traces of TaskGraphExecutor.
+ *
+ * With `ExecutorOptions::tracing`, every worker records one event per
+ * `progress()` call into its own ring buffer, which only the worker writes
+ * during a run, so pushing an event takes no lock and no atomic operation.
+ * When and by whom a task was made ready crosses threads, so the executor
+ * keeps it in per-task atomics, written and read with relaxed ordering. After
+ * the run, `TaskGraphExecutor::trace()` collects the buffers into a `Trace`,
+ * which can be exported in the Chrome trace event format (load it in
+ * chrome://tracing or https://ui.perfetto.dev) or summarized by `stats()`.
+ */
+
+namespace cppkit {
+
+namespace taskgraph {
+
+// No task, e.g., the trigger of a source task
+constexpr uint32_t kNoTask = std::numeric_limits<uint32_t>::max();
+
+// One `progress()` call of a task
+struct TraceEvent {
+  uint32_t task;     // Dense index of the task
+  uint32_t trigger;  // The upstream task whose completion made it ready
+  int worker;   // The executing worker, `workerCount - 1` for the poller
+  int source;   // The worker whose deque the task was taken from, -1 if it
+                // came from a shared queue
+  bool finished;  // Whether `progress()` returned true
+  // Nanoseconds since the start of the run
+  int64_t ready;  // When the task became ready
+  int64_t start;
+  int64_t end;
+};
+
+// Summary of a trace
+struct TraceStats {
+  int64_t duration = 0;  // Wall time of the run in nanoseconds
+  int64_t busy = 0;      // Total time spent in `progress()` over all workers
+  int64_t idle = 0;      // Total time the workers did not run tasks
+  double utilization = 0;  // busy / (duration * workers)
+  size_t steals = 0;       // Events taken from the deque of another worker
+  // The realized critical path: starting from the task finishing last, follow
+  // the upstream task which made each task ready back to a source. Its length
+  // is the time spent in `progress()` along the path, so a path as long as the
+  // run means the graph is latency-bound, and a short one with low
+  // utilization means it is starved of parallelism.
+  int64_t criticalPath = 0;
+  std::vector<uint32_t> criticalPathTasks;  // From the source to the end
+};
+
+// The trace of one run
+struct Trace {
+  int workerCount = 0;  // Workers including the polling thread (if any)
+  int64_t duration = 0;
+  size_t dropped = 0;  // Events lost by the overflow of ring buffers
+  std::vector<TraceEvent> events;
+  std::vector<std::string> taskIds;  // `id()` of the tasks by dense index
+
+  // Compute the summary statistics.
+  TraceStats stats() const {
+    TraceStats s;
+    s.duration = duration;
+    std::vector<const TraceEvent*> last(taskIds.size(), nullptr);
+    std::vector<int64_t> busy(taskIds.size(), 0);
+    for (auto& e : events) {
+      s.busy += e.end - e.start;
+      if (e.task < busy.size()) busy[e.task] += e.end - e.start;
+      if (e.source >= 0 && e.source != e.worker) s.steals++;
+      if (e.finished && e.task < last.size()) last[e.task] = &e;
+    }
+    s.idle = std::max<int64_t>(0, duration * workerCount - s.busy);
+    if (duration > 0 && workerCount > 0) {
+      s.utilization = static_cast<double>(s.busy) / duration / workerCount;
+    }
+    const TraceEvent* e = nullptr;
+    for (auto f : last) {
+      if (f && (!e || f->end > e->end)) e = f;
+    }
+    for (size_t k = 0; e && k < last.size(); k++) {
+      s.criticalPathTasks.push_back(e->task);
+      s.criticalPath += busy[e->task];
+      e = e->trigger < last.size() ? last[e->trigger] : nullptr;
+    }
+    std::reverse(s.criticalPathTasks.begin(), s.criticalPathTasks.end());
+    return s;
+  }
+
+  // Export in the Chrome trace event format. Every event is a complete slice
+  // on the thread of its worker, carrying the ready time, the steal source
+  // and the trigger as arguments.
+  std::string toChromeTrace() const {
+    std::ostringstream os;
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for (int w = 0; w < workerCount; w++) {
+      os << (w ? "," : "")
+         << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << w
+         << ",\"args\":{\"name\":\"worker " << w << "\"}}";
+    }
+    for (auto& e : events) {
+      os << ",{\"name\":\"" << escape(taskId(e.task))
+         << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.worker
+         << ",\"ts\":" << microseconds(e.start)
+         << ",\"dur\":" << microseconds(e.end - e.start)
+         << ",\"args\":{\"ready\":" << microseconds(e.ready)
+         << ",\"source\":" << e.source << ",\"trigger\":\""
+         << (e.trigger == kNoTask ? "" : escape(taskId(e.trigger)))
+         << "\",\"finished\":" << (e.finished ? "true" : "false") << "}}";
+    }
+    os << "]}";
+    return os.str();
+  }
+
+private:
+  std::string taskId(uint32_t task) const {
+    return task < taskIds.size() ? taskIds[task] : std::to_string(task);
+  }
+  static std::string microseconds(int64_t ns) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3f", ns / 1000.0);
+    return buf;
+  }
+  static std::string escape(const std::string& s) {
+    std::string r;
+    for (char c : s) {
+      if (c == '"' || c == '\\') {
+        r += '\\';
+        r += c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+        char buf[8];
+        std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+        r += buf;
+      } else {
+        r += c;
+      }
+    }
+    return r;
+  }
+};
+
+}  // namespace taskgraph
+
+namespace detail {
+// A fixed-size ring of trace events written by a single thread. When full, the
+// oldest events are overwritten.
+struct TraceRing {
+  void reset(size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n *= 2;
+    if (events.size() != n) events.resize(n);
+    head = 0;
+  }
+  void push(const taskgraph::TraceEvent& e) {
+    events[head & (events.size() - 1)] = e;
+    head++;
+  }
+  // Append the recorded events in order, return how many were overwritten.
+  size_t collect(std::vector<taskgraph::TraceEvent>& out) const {
+    const size_t n = std::min(head, events.size());
+    for (size_t i = head - n; i < head; i++) {
+      out.push_back(events[i & (events.size() - 1)]);
+    }
+    return head - n;
+  }
+
+  std::vector<taskgraph::TraceEvent> events;
+  size_t head = 0;  // Number of events pushed
+  char padding_[64];
+};
+}  // namespace detail
+
+}  // namespace cppkit
+
+#endif
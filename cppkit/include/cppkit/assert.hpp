@@ -21,15 +21,23 @@
 // Users can register their own error handler for these different types of
 // assert macros to customize the failure behavior.
 //
-// CPPKIT_ASSERT is very lightweight. It consists of only two files: `asrt.h`
-// and `asrt.cpp`. If the default failure behavior is enough, users can set
-// `CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER` to `0` and uses only `asrt.h`.
+// CPPKIT_ASSERT consists of two files: `assert.hpp` and `assert.cpp`. If the
+// default failure behavior is enough, users can set
+// `CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER` to `0` and use only
+// `assert.hpp`.
+//
+// Failure messages are rendered with fmt (version 8 or later), so both files
+// need the fmt headers on the include path, and either `FMT_HEADER_ONLY`
+// defined or a linked fmt library, also in the header-only mode. The
+// `cppkit_OBJECTS` CMake target brings the fmt bundled in this repository,
+// which comes first on the include path; put it before any system fmt when
+// building by other means.
 //
 // ## Usage
 //
 // Just include `assert.hpp` and call
 // `CPPKIT_<ASSERT|REQUIRE|ENSURE|CHECK>_<EQ|NE|GT|GE|LT|LE|TRUE|FALSE>` in the
-// code to declare assertions. Add `asrt.cpp` to the build system if
+// code to declare assertions. Add `assert.cpp` to the build system if
 // customization of error handlers are used.
 //
 // ## Customizations
@@ -44,6 +52,23 @@
 // follow the setting of `ASSERT`, and the `CHECK` macro is enabled.
 // 3. set `ASSERT_ENABLE_SHORT_MACROS` to `0` to disable short macros. Default
 // to `1` if no name collision is found.
+// 4. set `CPPKIT_ASSERT_SAMPLED_FAILURE_LIMIT` to the most failures per second
+// reported by each `CPPKIT_CHECK_SAMPLED_*` site, `0` for unlimited. Default
+// to `10`.
+// 5. set `CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS` to the most elements of a
+// container rendered in a failure message, the rest being counted only.
+// Default to `16`.
+// 6. set `CPPKIT_ASSERT_ENABLE_PROFILER` to `1` to count the evaluations and
+// the failures of every assertion site, and `CPPKIT_ASSERT_PROFILE_CYCLES` to
+// `1` to also count the cycles spent in them. The sites are reported to
+// stderr at exit, the most costly first, unless
+// `CPPKIT_ASSERT_PROFILE_REPORT_AT_EXIT` is `0`, and on demand by
+// `cppkit::reportAssertionProfile()`. Default to `0`.
+//
+// `CPPKIT_CHECK_SAMPLED_<OP>(rate, ...)` is a check for hot loops evaluated
+// on a sample of its passes: every `rate`-th pass on each thread if `rate` is
+// an integer, or each pass with probability `rate` if it is a floating-point
+// number.
 //
 // Users can customize the error handler by defining function with the
 // following signature and register to the system with
@@ -95,6 +120,30 @@
 #ifndef CPPKIT_ASSERT_ENABLE_SHORT_MACROS
 #define CPPKIT_ASSERT_ENABLE_SHORT_MACROS 0
 #endif
+// The most failures per second of each sampled check site passed to the
+// error handler, 0 for unlimited. Default to 10.
+#ifndef CPPKIT_ASSERT_SAMPLED_FAILURE_LIMIT
+#define CPPKIT_ASSERT_SAMPLED_FAILURE_LIMIT 10
+#endif
+// The most elements of a container rendered in a failure message. Default to
+// 16.
+#ifndef CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS
+#define CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS 16
+#endif
+// Determine whether to count the evaluations and the failures of every
+// assertion site, default to 0.
+#ifndef CPPKIT_ASSERT_ENABLE_PROFILER
+#define CPPKIT_ASSERT_ENABLE_PROFILER 0
+#endif
+// Determine whether the profiler also counts the cycles spent in every site,
+// default to 0.
+#ifndef CPPKIT_ASSERT_PROFILE_CYCLES
+#define CPPKIT_ASSERT_PROFILE_CYCLES 0
+#endif
+// Determine whether the profiler reports to stderr at exit, default to 1.
+#ifndef CPPKIT_ASSERT_PROFILE_REPORT_AT_EXIT
+#define CPPKIT_ASSERT_PROFILE_REPORT_AT_EXIT 1
+#endif
 // Determine whether to enable custom error handler, default to 1.
 #ifndef CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER
 #define CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER 1
@@ -105,48 +154,89 @@
 // ==========================================================================
 
 #if CPPKIT_ASSERT_ENABLE == 1
+#include <algorithm>  // to sort the profiles of sites
+#include <atomic>   // for the failure limiters of sampled checks
+#include <chrono>   // for the failure limiters of sampled checks
 #include <complex>  // to support formatting complex numbers
-#include <cstring>  // required by snprintf
-#include <map>      // to support formatting map
+#include <cstdint>
+#include <cstdio>   // to report the profiles of sites
+#include <cstdlib>  // for std::atexit
+#include <cstring>
+#include <fmt/format.h>  // to render failures into memory buffers
+#if !defined(FMT_VERSION) || FMT_VERSION < 80000
+#error "assert.hpp requires fmt 8 or later, see the top of this file"
+#endif
+#include <map>           // to support formatting map
 #include <memory>
-#include <sstream>        // required by make_eval_expr
+#include <ostream>        // to render objects with operator<<
+#include <stdexcept>      // for std::logic_error
+#include <streambuf>      // to render objects with operator<<
 #include <string>         // required by std::string
 #include <type_traits>    // for all type traits
 #include <unordered_map>  // to support formatting unordered_map
 #include <utility>        // for std::enable_if
 #include <vector>         // to support formatting vector
+#if CPPKIT_ASSERT_ENABLE_PROFILER == 1 && CPPKIT_ASSERT_PROFILE_CYCLES == 1
+#if defined(_MSC_VER)
+#include <intrin.h>  // for __rdtsc
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // for __rdtsc
+#endif
+#endif
 #endif
 
 namespace cppkit {
 enum { CHAN_ASSERT = 0, CHAN_CHECK, CHAN_REQUIRE, CHAN_ENSURE, CHAN_COUNT_ };
+
+// The static description of an assertion site. Every assertion macro defines
+// one as a static constexpr object, so a site costs no code to describe and
+// is identified by its address.
+struct AssertionSite {
+  const char *file;
+  int line;
+  int channel;  // One of CHAN_*
+  int op;       // One of detail::CPPKIT_ASSERT_CMP_*
+  const char *expr;  // The asserted expression, e.g., "x < y"
+};
+
 class ErrorHandling {
 public:
   typedef void (*ErrorHandler)(const std::string &file, int line,
                                const std::string &raw_expr,
                                const std::string &eval_expr);
 #if CPPKIT_ASSERT_ENABLE == 1 && CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER == 1
+  // The handlers of every channel form a stack, whose top handles the
+  // failures. Changing a stack is thread-safe, and failing threads read it
+  // without locking.
   static void pushHandler(int channel, ErrorHandler handler);
   static ErrorHandler popHandler(int channel);
   static void resetHandler(int channel, ErrorHandler handler = NULL);
-  // Internal function used by binary_assert
-  static void handleError_(int channel, const std::string &file, int line,
-                           const std::string &raw_expr,
-                           const std::string &eval_expr);
+  // Override the stack of a channel on the calling thread only, NULL to stop
+  // overriding. Return the previous override.
+  static ErrorHandler setThreadHandler(int channel, ErrorHandler handler);
+  // Internal function used by binary_assert, `eval_expr` is not
+  // null-terminated.
+  static void handleError_(const AssertionSite *site, const char *eval_expr,
+                           size_t eval_size);
 #else
   static void pushHandler(int channel, ErrorHandler handler) {}
   static ErrorHandler popHandler(int channel) { return NULL; }
   static void resetHandler(int channel, ErrorHandler handler = NULL) {}
+  static ErrorHandler setThreadHandler(int channel, ErrorHandler handler) {
+    return NULL;
+  }
 #if CPPKIT_ASSERT_ENABLE == 1
-  // Internal function used by binary_assert
-  static void handleError_(int channel, const std::string &file, int line,
-                           const std::string &raw_expr,
-                           const std::string &eval_expr) {
-    static std::string channel_names[CHAN_COUNT_] = {"assert", "check",
+  // Internal function used by binary_assert, `eval_expr` is not
+  // null-terminated.
+  static void handleError_(const AssertionSite *site, const char *eval_expr,
+                           size_t eval_size) {
+    static const char *channel_names[CHAN_COUNT_] = {"assert", "check",
                                                      "require", "ensure"};
-    std::ostringstream oss;
-    oss << file << ":" << line << ": " << channel_names[channel] << "("
-        << raw_expr << ") failed, values (" << eval_expr << ")";
-    throw std::logic_error(oss.str());
+    fmt::memory_buffer msg;
+    fmt::format_to(std::back_inserter(msg), "{}:{}: {}({}) failed, values ({})",
+                   site->file, site->line, channel_names[site->channel],
+                   site->expr, fmt::string_view(eval_expr, eval_size));
+    throw std::logic_error(fmt::to_string(msg));
   }
 #endif
 #endif
@@ -159,6 +249,21 @@ public:
 
 #if CPPKIT_ASSERT_ENABLE == 1
 
+// Branch hints keeping the failure path out of the hot code
+#if defined(__GNUC__) || defined(__clang__)
+#define CPPKIT_ASSERT_LIKELY(x) __builtin_expect(!!(x), 1)
+#define CPPKIT_ASSERT_NOINLINE __attribute__((noinline))
+#define CPPKIT_ASSERT_COLD __attribute__((cold))
+#elif defined(_MSC_VER)
+#define CPPKIT_ASSERT_LIKELY(x) (x)
+#define CPPKIT_ASSERT_NOINLINE __declspec(noinline)
+#define CPPKIT_ASSERT_COLD
+#else
+#define CPPKIT_ASSERT_LIKELY(x) (x)
+#define CPPKIT_ASSERT_NOINLINE
+#define CPPKIT_ASSERT_COLD
+#endif
+
 // Implementation details
 namespace cppkit {
 namespace detail {
@@ -173,12 +278,12 @@ namespace detail {
 // evaluation.
 //
 
-const int CPPKIT_ASSERT_CMP_EQ = 0;
-const int CPPKIT_ASSERT_CMP_NE = 1;
-const int CPPKIT_ASSERT_CMP_GT = 2;
-const int CPPKIT_ASSERT_CMP_GE = 3;
-const int CPPKIT_ASSERT_CMP_LT = 4;
-const int CPPKIT_ASSERT_CMP_LE = 5;
+constexpr int CPPKIT_ASSERT_CMP_EQ = 0;
+constexpr int CPPKIT_ASSERT_CMP_NE = 1;
+constexpr int CPPKIT_ASSERT_CMP_GT = 2;
+constexpr int CPPKIT_ASSERT_CMP_GE = 3;
+constexpr int CPPKIT_ASSERT_CMP_LT = 4;
+constexpr int CPPKIT_ASSERT_CMP_LE = 5;
 
 template <int OP>
 struct RelationalComparision {
@@ -188,7 +293,7 @@ struct RelationalComparision {
     return false;
   }
   // Build a string representation of the comparision operator
-  static std::string str() { return "?"; }
+  static const char *str() { return "?"; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_EQ> {
@@ -196,7 +301,7 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_EQ> {
   static bool valid(const L &x, const R &y) {
     return x == y;
   }
-  static std::string str() { return "=="; }
+  static const char *str() { return "=="; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_NE> {
@@ -204,7 +309,7 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_NE> {
   static bool valid(const L &x, const R &y) {
     return x != y;
   }
-  static std::string str() { return "!="; }
+  static const char *str() { return "!="; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_GT> {
@@ -212,7 +317,7 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_GT> {
   static bool valid(const L &x, const R &y) {
     return x > y;
   }
-  static std::string str() { return ">"; }
+  static const char *str() { return ">"; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_GE> {
@@ -220,7 +325,7 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_GE> {
   static bool valid(const L &x, const R &y) {
     return x >= y;
   }
-  static std::string str() { return ">="; }
+  static const char *str() { return ">="; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_LT> {
@@ -228,7 +333,7 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_LT> {
   static bool valid(const L &x, const R &y) {
     return x < y;
   }
-  static std::string str() { return "<"; }
+  static const char *str() { return "<"; }
 };
 template <>
 struct RelationalComparision<CPPKIT_ASSERT_CMP_LE> {
@@ -236,26 +341,11 @@ struct RelationalComparision<CPPKIT_ASSERT_CMP_LE> {
   static bool valid(const L &x, const R &y) {
     return x <= y;
   }
-  static std::string str() { return "<="; }
+  static const char *str() { return "<="; }
 };
 
-template <typename T1, typename T2>
-struct Result {
-  Result(T1 x_, T2 y_) : x(x_), y(y_) {}
-  T1 x;
-  T2 y;
-};
-template <typename T1, typename T2>
-inline Result<T1, T2> make_result(T1 x, T2 y) {
-  return Result<T1, T2>(x, y);
-}
-
-template <int OP>
-inline std::string make_expr_str(const char *x, const char *y) {
-  return std::string(x) + " " + RelationalComparision<OP>::str() + " " + y;
-}
-
-// A robust toString implementation that never fails.
+// A robust rendering of values into a memory buffer that never fails. At most
+// `CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS` elements of a container are rendered.
 namespace to_string {
 template <typename T, typename = void>
 struct HasFormattedOutput : std::false_type {};
@@ -264,96 +354,534 @@ struct HasFormattedOutput<T, decltype((void)(std::declval<std::ostream>()
                                              << std::declval<T>()))>
     : std::true_type {};
 
+// A stream buffer appending to a memory buffer, so objects are streamed
+// without building a string.
+class BufferStreambuf : public std::streambuf {
+public:
+  explicit BufferStreambuf(fmt::memory_buffer &out) : out_(out) {}
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (traits_type::eq_int_type(ch, traits_type::eof())) {
+      return traits_type::not_eof(ch);
+    }
+    out_.push_back(traits_type::to_char_type(ch));
+    return ch;
+  }
+  std::streamsize xsputn(const char *s, std::streamsize n) override {
+    out_.append(s, s + n);
+    return n;
+  }
+
+private:
+  fmt::memory_buffer &out_;
+};
+
+inline void append(fmt::memory_buffer &out, const char *s) {
+  out.append(s, s + std::strlen(s));
+}
+
+template <typename T>
+void render(fmt::memory_buffer &out, const std::vector<T> &v);
+template <typename K, typename V>
+void render(fmt::memory_buffer &out, const std::map<K, V> &v);
+template <typename K, typename V>
+void render(fmt::memory_buffer &out, const std::unordered_map<K, V> &v);
+
+template <typename T, typename std::enable_if<std::is_arithmetic<T>::value,
+                                              int>::type = 0>
+void render(fmt::memory_buffer &out, const T &v) {
+  fmt::format_to(std::back_inserter(out), "{}", v);
+}
+template <typename T,
+          typename std::enable_if<std::is_pointer<T>::value, int>::type = 0>
+void render(fmt::memory_buffer &out, const T &v) {
+  fmt::format_to(std::back_inserter(out), "{}", fmt::ptr(v));
+}
 template <typename T,
-          typename std::enable_if<HasFormattedOutput<T>::value, int>::type = 0>
-std::string toString(const T &v) {
-  std::ostringstream oss;
-  oss << v;
-  return oss.str();
+          typename std::enable_if<!std::is_arithmetic<T>::value &&
+                                      !std::is_pointer<T>::value &&
+                                      HasFormattedOutput<T>::value,
+                                  int>::type = 0>
+void render(fmt::memory_buffer &out, const T &v) {
+  BufferStreambuf buf(out);
+  std::ostream os(&buf);
+  os << v;
 }
 template <typename T,
-          typename std::enable_if<!HasFormattedOutput<T>::value, int>::type = 0>
-std::string toString(const T &v) {
-  std::ostringstream oss;
-  oss << "Object@" << &v;
-  return oss.str();
+          typename std::enable_if<!std::is_arithmetic<T>::value &&
+                                      !std::is_pointer<T>::value &&
+                                      !HasFormattedOutput<T>::value,
+                                  int>::type = 0>
+void render(fmt::memory_buffer &out, const T &v) {
+  fmt::format_to(std::back_inserter(out), "Object@{}", fmt::ptr(&v));
+}
+inline void render(fmt::memory_buffer &out, std::nullptr_t) {
+  append(out, "nullptr");
+}
+inline void render(fmt::memory_buffer &out, const std::string &v) {
+  out.push_back('"');
+  out.append(v.data(), v.data() + v.size());
+  out.push_back('"');
 }
-std::string toString(std::nullptr_t v) { return std::string("nullptr"); }
+inline void render(fmt::memory_buffer &out, const char *v) {
+  out.push_back('"');
+  append(out, v);
+  out.push_back('"');
+}
+inline void render(fmt::memory_buffer &out, char *v) {
+  render(out, static_cast<const char *>(v));
+}
+
 template <typename T>
-std::string toString(const std::vector<T> &v) {
-  std::string result("[");
-  if (!v.empty()) {
-    result += toString(v.front());
-    for (int i = 1; i < v.size(); i++) result += ", " + toString(v[i]);
-  }
-  result += "]";
-  return result;
+void render_element(fmt::memory_buffer &out, const T &v) {
+  render(out, v);
 }
 template <typename K, typename V>
-std::string toString(const std::map<K, V> &v) {
-  std::string result("{");
-  if (!v.empty()) {
-    bool isFirst = true;
-    for (auto kv : v) {
-      if (isFirst) {
-        result += toString(kv.first) + ": " + toString(kv.second);
-        isFirst = false;
-      } else {
-        result += ", " + toString(kv.first) + ": " + toString(kv.second);
-      }
+void render_element(fmt::memory_buffer &out, const std::pair<const K, V> &kv) {
+  render(out, kv.first);
+  append(out, ": ");
+  render(out, kv.second);
+}
+
+// Render the elements of a container between the brackets, then how many
+// elements are left out, if any.
+template <typename C>
+void render_elements(fmt::memory_buffer &out, const C &v, char open,
+                     char close) {
+  out.push_back(open);
+  size_t n = 0;
+  for (const auto &e : v) {
+    if (n > 0) append(out, ", ");
+    if (n == CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS) {
+      fmt::format_to(std::back_inserter(out), "... ({} more)", v.size() - n);
+      break;
     }
+    render_element(out, e);
+    n++;
   }
-  result += "}";
-  return result;
+  out.push_back(close);
+}
+template <typename T>
+void render(fmt::memory_buffer &out, const std::vector<T> &v) {
+  render_elements(out, v, '[', ']');
 }
 template <typename K, typename V>
-std::string toString(const std::unordered_map<K, V> &v) {
-  std::string result("{");
-  if (!v.empty()) {
-    bool isFirst = true;
-    for (auto kv : v) {
-      if (isFirst) {
-        result += toString(kv.first) + ": " + toString(kv.second);
-        isFirst = false;
-      } else {
-        result += ", " + toString(kv.first) + ": " + toString(kv.second);
-      }
+void render(fmt::memory_buffer &out, const std::map<K, V> &v) {
+  render_elements(out, v, '{', '}');
+}
+template <typename K, typename V>
+void render(fmt::memory_buffer &out, const std::unordered_map<K, V> &v) {
+  render_elements(out, v, '{', '}');
+}
+}  // namespace to_string
+
+// The buffer failures are rendered into. It is reused by every failure of the
+// calling thread, so rendering allocates only when it outgrows all before.
+inline fmt::memory_buffer &failure_buffer() {
+  static thread_local fmt::memory_buffer buffer;
+  return buffer;
+}
+
+// Count the failures being reported on the calling thread. A failure reported
+// while another is, e.g., by an `operator<<` or a handler that does not throw,
+// is nested and shall not touch the buffers of the outer one.
+class FailureDepth {
+public:
+  FailureDepth() { ++depth(); }
+  ~FailureDepth() { --depth(); }
+  FailureDepth(const FailureDepth &) = delete;
+  FailureDepth &operator=(const FailureDepth &) = delete;
+  bool nested() const { return depth() > 1; }
+
+private:
+  static int &depth() {
+    static thread_local int d = 0;
+    return d;
+  }
+};
+
+// Render `x OP y` into `out`
+template <int OP, typename L, typename R>
+void render_eval(fmt::memory_buffer &out, const L &x, const R &y) {
+  out.clear();
+  to_string::render(out, x);
+  out.push_back(' ');
+  to_string::append(out, RelationalComparision<OP>::str());
+  out.push_back(' ');
+  to_string::render(out, y);
+}
+
+// Render `x OP y` and pass it to the handler. The outermost failure of a
+// thread renders into the failure buffer, nested ones into their own.
+template <int OP, typename L, typename R>
+void report_failure(const AssertionSite *site, const L &x, const R &y) {
+  FailureDepth depth;
+  fmt::memory_buffer local;
+  fmt::memory_buffer &eval = depth.nested() ? local : failure_buffer();
+  render_eval<OP>(eval, x, y);
+  cppkit::ErrorHandling::handleError_(site, eval.data(), eval.size());
+}
+
+// Scalars are passed to the failure path by value, so their addresses are not
+// taken and they can stay in registers on the success path. Arrays decay to
+// pointers, so string literals are rendered as quoted strings.
+template <typename T>
+using failure_arg_t = typename std::conditional<
+    std::is_array<T>::value, const typename std::remove_extent<T>::type *,
+    typename std::conditional<std::is_scalar<T>::value, T,
+                              const T &>::type>::type;
+
+// Report a failed assertion. The values are rendered here, out of the line of
+// the caller.
+template <int OP, typename L, typename R>
+CPPKIT_ASSERT_NOINLINE CPPKIT_ASSERT_COLD void binary_assert_failed(
+    const AssertionSite *site, failure_arg_t<L> x, failure_arg_t<R> y) {
+  report_failure<OP>(site, x, y);
+}
+
+// Check an assertion. The operands are taken by reference and only the
+// comparison is inlined, so a passing assertion costs a compare and a branch.
+template <int OP, typename L, typename R>
+inline void binary_assert(const AssertionSite *site, const L &x, const R &y) {
+  if (CPPKIT_ASSERT_LIKELY(RelationalComparision<OP>::valid(x, y))) return;
+  binary_assert_failed<OP, L, R>(site, x, y);
+}
+
+//
+// Sampling of `CPPKIT_CHECK_SAMPLED_*`. An integral rate `n` evaluates every
+// n-th pass of a site on each thread, a floating-point rate `p` evaluates a
+// pass with probability p.
+//
+template <typename T,
+          typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+inline bool sample(unsigned &counter, T n) {
+  if (++counter < static_cast<unsigned>(n)) return false;
+  counter = 0;
+  return true;
+}
+template <typename T, typename std::enable_if<std::is_floating_point<T>::value,
+                                              int>::type = 0>
+inline bool sample(unsigned &, T p) {
+  // A per-thread xorshift generator
+  static thread_local uint64_t state = 0;
+  if (state == 0) state = reinterpret_cast<uintptr_t>(&state) | 1;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return static_cast<double>(state >> 11) * (1.0 / 9007199254740992.0) < p;
+}
+
+// Limit the failures of one site reported per second
+class FailureLimiter {
+public:
+  constexpr FailureLimiter() {}
+  // Check whether a failure is reported, i.e., fewer than `limit` failures
+  // have been reported in the current second.
+  bool allow(int limit) {
+    if (limit <= 0) return true;
+    int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    int64_t window = window_.load(std::memory_order_relaxed);
+    if (window != now && window_.compare_exchange_strong(
+                             window, now, std::memory_order_relaxed)) {
+      count_.store(0, std::memory_order_relaxed);
     }
+    return count_.fetch_add(1, std::memory_order_relaxed) < limit;
   }
-  result += "}";
-  return result;
+
+private:
+  std::atomic<int64_t> window_{0};
+  std::atomic<int> count_{0};
+};
+
+// Report a failed sampled assertion unless its site exceeds the rate limit.
+template <int OP, typename L, typename R>
+CPPKIT_ASSERT_NOINLINE CPPKIT_ASSERT_COLD void sampled_assert_failed(
+    const AssertionSite *site, FailureLimiter *limiter, failure_arg_t<L> x,
+    failure_arg_t<R> y) {
+  if (!limiter->allow(CPPKIT_ASSERT_SAMPLED_FAILURE_LIMIT)) return;
+  report_failure<OP>(site, x, y);
 }
-std::string toString(const std::string &v) { return "\"" + v + "\""; }
-std::string toString(const char *v) { return "\"" + std::string(v) + "\""; }
-}  // namespace to_string
 
+// Check a sampled assertion, see `binary_assert()`
+template <int OP, typename L, typename R>
+inline void sampled_assert(const AssertionSite *site, FailureLimiter *limiter,
+                           const L &x, const R &y) {
+  if (CPPKIT_ASSERT_LIKELY(RelationalComparision<OP>::valid(x, y))) return;
+  sampled_assert_failed<OP, L, R>(site, limiter, x, y);
+}
+
+#if CPPKIT_ASSERT_ENABLE_PROFILER == 1
+//
+// Profiling of assertion sites. Every site has static counters next to its
+// description, which are linked into a registry on the first evaluation.
+//
+class SiteCounters;
+
+// The head of the registry
+inline std::atomic<SiteCounters *> &site_registry() {
+  static std::atomic<SiteCounters *> head{nullptr};
+  return head;
+}
+
+#if CPPKIT_ASSERT_PROFILE_CYCLES == 1
+// Read the cycle counter, or a steady clock in nanoseconds where there is no
+// cycle counter.
+inline uint64_t profile_clock() {
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || \
+    defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+#endif
+
+class SiteCounters {
+public:
+  constexpr explicit SiteCounters(const AssertionSite *site) : site_(site) {}
+
+  void evaluated() {
+    if (!registered_.load(std::memory_order_relaxed)) registerSite();
+    evaluations_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void failed() { failures_.fetch_add(1, std::memory_order_relaxed); }
+  void addCycles(uint64_t cycles) {
+    cycles_.fetch_add(cycles, std::memory_order_relaxed);
+  }
+  void reset() {
+    evaluations_.store(0, std::memory_order_relaxed);
+    failures_.store(0, std::memory_order_relaxed);
+    cycles_.store(0, std::memory_order_relaxed);
+  }
+
+  const AssertionSite *site() const { return site_; }
+  uint64_t evaluations() const {
+    return evaluations_.load(std::memory_order_relaxed);
+  }
+  uint64_t failures() const {
+    return failures_.load(std::memory_order_relaxed);
+  }
+  uint64_t cycles() const { return cycles_.load(std::memory_order_relaxed); }
+  // The site registered before this one
+  const SiteCounters *next() const { return next_; }
+
+private:
+  void registerSite();
+
+  const AssertionSite *site_;
+  SiteCounters *next_ = nullptr;
+  std::atomic<bool> registered_{false};
+  std::atomic<uint64_t> evaluations_{0};
+  std::atomic<uint64_t> failures_{0};
+  std::atomic<uint64_t> cycles_{0};
+};
+
+// Count an evaluation of a site, and the cycles until the end of the scope
+class SiteTimer {
+public:
+  explicit SiteTimer(SiteCounters *counters) : counters_(counters) {
+    counters_->evaluated();
+#if CPPKIT_ASSERT_PROFILE_CYCLES == 1
+    start_ = profile_clock();
+#endif
+  }
+  ~SiteTimer() {
+#if CPPKIT_ASSERT_PROFILE_CYCLES == 1
+    counters_->addCycles(profile_clock() - start_);
+#endif
+  }
+  SiteTimer(const SiteTimer &) = delete;
+  SiteTimer &operator=(const SiteTimer &) = delete;
+
+private:
+  SiteCounters *counters_;
+#if CPPKIT_ASSERT_PROFILE_CYCLES == 1
+  uint64_t start_;
+#endif
+};
+
+// Check an assertion counting its failures, see `binary_assert()`
 template <int OP, typename L, typename R>
-inline std::string make_eval_str(const L &x, const R &y) {
-  return to_string::toString(x) + " " + RelationalComparision<OP>::str() + " " +
-         to_string::toString(y);
+inline void profiled_assert(const AssertionSite *site, SiteCounters *counters,
+                            const L &x, const R &y) {
+  if (CPPKIT_ASSERT_LIKELY(RelationalComparision<OP>::valid(x, y))) return;
+  counters->failed();
+  binary_assert_failed<OP, L, R>(site, x, y);
 }
 
+// Check a sampled assertion counting its failures, rate limited or not
 template <int OP, typename L, typename R>
-inline void binary_assert(int channel, const char *file, int line,
-                          const std::string &expr, const Result<L, R> &result) {
-  if (RelationalComparision<OP>::valid(result.x, result.y)) return;
-  cppkit::ErrorHandling::handleError_(channel, file, line, expr,
-                                      make_eval_str<OP>(result.x, result.y));
+inline void profiled_sampled_assert(const AssertionSite *site,
+                                    FailureLimiter *limiter,
+                                    SiteCounters *counters, const L &x,
+                                    const R &y) {
+  if (CPPKIT_ASSERT_LIKELY(RelationalComparision<OP>::valid(x, y))) return;
+  counters->failed();
+  sampled_assert_failed<OP, L, R>(site, limiter, x, y);
+}
+#endif
+
+}  // namespace detail
+
+#if CPPKIT_ASSERT_ENABLE_PROFILER == 1
+// The profile of an assertion site
+struct AssertionProfile {
+  const AssertionSite *site;
+  uint64_t evaluations;
+  uint64_t failures;
+  uint64_t cycles;  // 0 unless CPPKIT_ASSERT_PROFILE_CYCLES is 1
+};
+
+// Return the profiles of the sites evaluated so far, the most costly first,
+// i.e., by cycles if they are counted and by evaluations otherwise.
+inline std::vector<AssertionProfile> assertionProfile() {
+  std::vector<AssertionProfile> profiles;
+  const detail::SiteCounters *c =
+      detail::site_registry().load(std::memory_order_acquire);
+  for (; c; c = c->next()) {
+    profiles.push_back({c->site(), c->evaluations(), c->failures(),
+                        c->cycles()});
+  }
+  std::sort(profiles.begin(), profiles.end(),
+            [](const AssertionProfile &a, const AssertionProfile &b) {
+              if (a.cycles != b.cycles) return a.cycles > b.cycles;
+              return a.evaluations > b.evaluations;
+            });
+  return profiles;
 }
 
+// Print the profiles of the sites evaluated so far, see `assertionProfile()`.
+inline void reportAssertionProfile(std::FILE *out = stderr) {
+  static const char *channel_names[CHAN_COUNT_] = {"assert", "check",
+                                                   "require", "ensure"};
+  auto profiles = assertionProfile();
+  fmt::print(out, "cppkit assertion profile: {} sites\n", profiles.size());
+  fmt::print(out, "{:>14} {:>10} {:>16} {:>10}  {}\n", "evaluations",
+             "failures", "cycles", "cycles/ev", "site");
+  for (const auto &p : profiles) {
+    fmt::print(out, "{:>14} {:>10} {:>16} {:>10.1f}  {}:{}: {}({})\n",
+               p.evaluations, p.failures, p.cycles,
+               p.evaluations ? double(p.cycles) / p.evaluations : 0.0,
+               p.site->file, p.site->line, channel_names[p.site->channel],
+               p.site->expr);
+  }
+  std::fflush(out);
+}
+
+// Zero the counters of the sites evaluated so far
+inline void resetAssertionProfile() {
+  detail::SiteCounters *c =
+      detail::site_registry().load(std::memory_order_acquire);
+  for (; c; c = const_cast<detail::SiteCounters *>(c->next())) c->reset();
+}
+
+namespace detail {
+inline void report_assertion_profile_at_exit() { reportAssertionProfile(); }
+
+inline CPPKIT_ASSERT_NOINLINE CPPKIT_ASSERT_COLD void
+SiteCounters::registerSite() {
+  if (registered_.exchange(true, std::memory_order_relaxed)) return;
+  std::atomic<SiteCounters *> &head = site_registry();
+  next_ = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(next_, this, std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+  }
+#if CPPKIT_ASSERT_PROFILE_REPORT_AT_EXIT == 1
+  static const bool scheduled =
+      std::atexit(report_assertion_profile_at_exit) == 0;
+  (void)scheduled;
+#endif
+}
 }  // namespace detail
+#endif
+
 }  // namespace cppkit
 
 // ==========================================================================
 // Macro definitions
 // ==========================================================================
 
-#define CPPKIT_ASSERT_CHAN_ASSERT_IMPL(CHAN, OP, x, y)                       \
-  cppkit::detail::binary_assert<cppkit::detail::CPPKIT_ASSERT_CMP_##OP>(     \
-      CHAN, __FILE__, __LINE__,                                              \
-      cppkit::detail::make_expr_str<cppkit::detail::CPPKIT_ASSERT_CMP_##OP>( \
-          #x, #y),                                                           \
-      cppkit::detail::make_result((x), (y)))
+#define CPPKIT_ASSERT_OP_STR_EQ "=="
+#define CPPKIT_ASSERT_OP_STR_NE "!="
+#define CPPKIT_ASSERT_OP_STR_GT ">"
+#define CPPKIT_ASSERT_OP_STR_GE ">="
+#define CPPKIT_ASSERT_OP_STR_LT "<"
+#define CPPKIT_ASSERT_OP_STR_LE "<="
+
+#if CPPKIT_ASSERT_ENABLE_PROFILER == 1
+// A profiled site counts its evaluations, including the operands.
+#define CPPKIT_ASSERT_CHAN_ASSERT_IMPL(CHAN, OP, x, y)                        \
+  do {                                                                        \
+    static constexpr cppkit::AssertionSite cppkit_assertion_site_ = {         \
+        __FILE__, __LINE__, CHAN, cppkit::detail::CPPKIT_ASSERT_CMP_##OP,     \
+        #x " " CPPKIT_ASSERT_OP_STR_##OP " " #y};                             \
+    static cppkit::detail::SiteCounters cppkit_assertion_counters_{           \
+        &cppkit_assertion_site_};                                             \
+    cppkit::detail::SiteTimer cppkit_assertion_timer_(                        \
+        &cppkit_assertion_counters_);                                         \
+    cppkit::detail::profiled_assert<cppkit::detail::CPPKIT_ASSERT_CMP_##OP>(  \
+        &cppkit_assertion_site_, &cppkit_assertion_counters_, (x), (y));      \
+  } while (0)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, OP, rate, x, y)                 \
+  do {                                                                        \
+    static thread_local unsigned cppkit_assertion_counter_ = 0;               \
+    if (!cppkit::detail::sample(cppkit_assertion_counter_, (rate))) break;    \
+    static constexpr cppkit::AssertionSite cppkit_assertion_site_ = {         \
+        __FILE__, __LINE__, CHAN, cppkit::detail::CPPKIT_ASSERT_CMP_##OP,     \
+        #x " " CPPKIT_ASSERT_OP_STR_##OP " " #y};                             \
+    static cppkit::detail::FailureLimiter cppkit_assertion_limiter_;          \
+    static cppkit::detail::SiteCounters cppkit_assertion_counters_{           \
+        &cppkit_assertion_site_};                                             \
+    cppkit::detail::SiteTimer cppkit_assertion_timer_(                        \
+        &cppkit_assertion_counters_);                                         \
+    cppkit::detail::profiled_sampled_assert<                                  \
+        cppkit::detail::CPPKIT_ASSERT_CMP_##OP>(                              \
+        &cppkit_assertion_site_, &cppkit_assertion_limiter_,                  \
+        &cppkit_assertion_counters_, (x), (y));                               \
+  } while (0)
+#else
+#define CPPKIT_ASSERT_CHAN_ASSERT_IMPL(CHAN, OP, x, y)                        \
+  do {                                                                        \
+    static constexpr cppkit::AssertionSite cppkit_assertion_site_ = {         \
+        __FILE__, __LINE__, CHAN, cppkit::detail::CPPKIT_ASSERT_CMP_##OP,     \
+        #x " " CPPKIT_ASSERT_OP_STR_##OP " " #y};                             \
+    cppkit::detail::binary_assert<cppkit::detail::CPPKIT_ASSERT_CMP_##OP>(    \
+        &cppkit_assertion_site_, (x), (y));                                   \
+  } while (0)
+// The operands of a sampled check are only evaluated in the sampled passes.
+#define CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, OP, rate, x, y)                 \
+  do {                                                                        \
+    static thread_local unsigned cppkit_assertion_counter_ = 0;               \
+    if (!cppkit::detail::sample(cppkit_assertion_counter_, (rate))) break;    \
+    static constexpr cppkit::AssertionSite cppkit_assertion_site_ = {         \
+        __FILE__, __LINE__, CHAN, cppkit::detail::CPPKIT_ASSERT_CMP_##OP,     \
+        #x " " CPPKIT_ASSERT_OP_STR_##OP " " #y};                             \
+    static cppkit::detail::FailureLimiter cppkit_assertion_limiter_;          \
+    cppkit::detail::sampled_assert<cppkit::detail::CPPKIT_ASSERT_CMP_##OP>(   \
+        &cppkit_assertion_site_, &cppkit_assertion_limiter_, (x), (y));       \
+  } while (0)
+#endif
+#define CPPKIT_ASSERT_CHAN_SAMPLED_EQ(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, EQ, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_NE(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, NE, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_GT(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, GT, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_GE(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, GE, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_LT(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, LT, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_LE(CHAN, rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, LE, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_TRUE(CHAN, rate, x) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, EQ, rate, bool(x), true)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_FALSE(CHAN, rate, x) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_IMPL(CHAN, EQ, rate, bool(x), false)
 #define CPPKIT_ASSERT_CHAN_ASSERT_EQ(CHAN, x, y) \
   CPPKIT_ASSERT_CHAN_ASSERT_IMPL(CHAN, EQ, x, y)
 #define CPPKIT_ASSERT_CHAN_ASSERT_NE(CHAN, x, y) \
@@ -379,6 +907,14 @@ inline void binary_assert(int channel, const char *file, int line,
 #define CPPKIT_ASSERT_CHAN_ASSERT_LE(CHAN, x, y)
 #define CPPKIT_ASSERT_CHAN_ASSERT_TRUE(CHAN, x)
 #define CPPKIT_ASSERT_CHAN_ASSERT_FALSE(CHAN, x)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_EQ(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_NE(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_GT(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_GE(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_LT(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_LE(CHAN, rate, x, y)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_TRUE(CHAN, rate, x)
+#define CPPKIT_ASSERT_CHAN_SAMPLED_FALSE(CHAN, rate, x)
 #endif
 
 #define CPPKIT_ASSERT_DO_ASSERT2(CH, OP, x, y) \
@@ -417,6 +953,23 @@ inline void binary_assert(int channel, const char *file, int line,
 #define CPPKIT_CHECK_LE(x, y) CPPKIT_ASSERT_DO_ASSERT2(CHECK, LE, x, y)
 #define CPPKIT_CHECK_TRUE(x) CPPKIT_ASSERT_DO_ASSERT1(CHECK, TRUE, x)
 #define CPPKIT_CHECK_FALSE(x) CPPKIT_ASSERT_DO_ASSERT1(CHECK, FALSE, x)
+// Sampled checks for hot loops, see `CPPKIT_ASSERT_CHAN_SAMPLED_IMPL`
+#define CPPKIT_CHECK_SAMPLED_EQ(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_EQ(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_NE(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_NE(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_GT(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_GT(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_GE(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_GE(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_LT(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_LT(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_LE(rate, x, y) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_LE(cppkit::CHAN_CHECK, rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_TRUE(rate, x) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_TRUE(cppkit::CHAN_CHECK, rate, x)
+#define CPPKIT_CHECK_SAMPLED_FALSE(rate, x) \
+  CPPKIT_ASSERT_CHAN_SAMPLED_FALSE(cppkit::CHAN_CHECK, rate, x)
 #else
 #define CPPKIT_CHECK_EQ(x, y)
 #define CPPKIT_CHECK_NE(x, y)
@@ -426,6 +979,14 @@ inline void binary_assert(int channel, const char *file, int line,
 #define CPPKIT_CHECK_LE(x, y)
 #define CPPKIT_CHECK_TRUE(x)
 #define CPPKIT_CHECK_FALSE(x)
+#define CPPKIT_CHECK_SAMPLED_EQ(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_NE(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_GT(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_GE(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_LT(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_LE(rate, x, y)
+#define CPPKIT_CHECK_SAMPLED_TRUE(rate, x)
+#define CPPKIT_CHECK_SAMPLED_FALSE(rate, x)
 #endif
 
 // The require macros
@@ -491,6 +1052,14 @@ inline void binary_assert(int channel, const char *file, int line,
 #define CHECK_LE(x, y) CPPKIT_CHECK_LE(x, y)
 #define CHECK_TRUE(x) CPPKIT_CHECK_TRUE(x)
 #define CHECK_FALSE(x) CPPKIT_CHECK_FALSE(x)
+#define CHECK_SAMPLED_EQ(rate, x, y) CPPKIT_CHECK_SAMPLED_EQ(rate, x, y)
+#define CHECK_SAMPLED_NE(rate, x, y) CPPKIT_CHECK_SAMPLED_NE(rate, x, y)
+#define CHECK_SAMPLED_GT(rate, x, y) CPPKIT_CHECK_SAMPLED_GT(rate, x, y)
+#define CHECK_SAMPLED_GE(rate, x, y) CPPKIT_CHECK_SAMPLED_GE(rate, x, y)
+#define CHECK_SAMPLED_LT(rate, x, y) CPPKIT_CHECK_SAMPLED_LT(rate, x, y)
+#define CHECK_SAMPLED_LE(rate, x, y) CPPKIT_CHECK_SAMPLED_LE(rate, x, y)
+#define CHECK_SAMPLED_TRUE(rate, x) CPPKIT_CHECK_SAMPLED_TRUE(rate, x)
+#define CHECK_SAMPLED_FALSE(rate, x) CPPKIT_CHECK_SAMPLED_FALSE(rate, x)
 #define REQUIRE_EQ(x, y) CPPKIT_REQUIRE_EQ(x, y)
 #define REQUIRE_NE(x, y) CPPKIT_REQUIRE_NE(x, y)
 #define REQUIRE_GT(x, y) CPPKIT_REQUIRE_GT(x, y)
@@ -2,20 +2,22 @@
 
 #if CPPKIT_ASSERT_ENABLE == 1 && CPPKIT_ASSERT_ENABLE_CUSTOM_ERROR_HANDLER == 1
 
+#include <atomic>
 #include <cassert>
-#include <cstdio>
+#include <iterator>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
 namespace {
-void handle_channel_error(const std::string &channel_name,
-                          const std::string &file, int line,
-                          const std::string &raw_expr,
+void handle_channel_error(const char *channel_name, const std::string &file,
+                          int line, const std::string &raw_expr,
                           const std::string &eval_expr) {
-  char msg[1024] = {'\0'};
-  snprintf(msg, 1023, "%s:%d: %s(%s) failed, values (%s)", file.c_str(), line,
-           channel_name.c_str(), raw_expr.c_str(), eval_expr.c_str());
-  throw std::logic_error(msg);
+  thread_local fmt::memory_buffer msg;
+  msg.clear();
+  fmt::format_to(std::back_inserter(msg), "{}:{}: {}({}) failed, values ({})",
+                 file, line, channel_name, raw_expr, eval_expr);
+  throw std::logic_error(fmt::to_string(msg));
 }
 
 void handle_assert_error(const std::string &file, int line,
@@ -39,15 +41,47 @@ void handle_check_error(const std::string &file, int line,
   handle_channel_error("check", file, line, raw_expr, eval_expr);
 }
 
-std::vector<cppkit::ErrorHandling::ErrorHandler>
-    handlers_[cppkit::CHAN_COUNT_] = {
-        std::vector<cppkit::ErrorHandling::ErrorHandler>(1,
-                                                         handle_assert_error),
-        std::vector<cppkit::ErrorHandling::ErrorHandler>(1, handle_check_error),
-        std::vector<cppkit::ErrorHandling::ErrorHandler>(1,
-                                                         handle_require_error),
-        std::vector<cppkit::ErrorHandling::ErrorHandler>(1,
-                                                         handle_ensure_error)};
+const cppkit::ErrorHandling::ErrorHandler
+    default_handlers_[cppkit::CHAN_COUNT_] = {
+        handle_assert_error, handle_check_error, handle_require_error,
+        handle_ensure_error};
+
+// The handlers of a channel form a stack, changed under a mutex. Its top is
+// published in an atomic, so failing threads only load the top.
+std::atomic<cppkit::ErrorHandling::ErrorHandler>
+    top_handlers_[cppkit::CHAN_COUNT_] = {
+        {handle_assert_error},
+        {handle_check_error},
+        {handle_require_error},
+        {handle_ensure_error}};
+
+std::mutex &handlers_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+// The stacks themselves, guarded by `handlers_mutex()`
+std::vector<cppkit::ErrorHandling::ErrorHandler> &handler_stack(int channel) {
+  static std::vector<cppkit::ErrorHandling::ErrorHandler>
+      stacks[cppkit::CHAN_COUNT_] = {
+          {handle_assert_error},
+          {handle_check_error},
+          {handle_require_error},
+          {handle_ensure_error}};
+  return stacks[channel];
+}
+
+// How many failures the current thread is handling, more than one when a
+// handler fails an assertion itself
+thread_local int handler_depth_ = 0;
+struct HandlerDepth {
+  HandlerDepth() { ++handler_depth_; }
+  ~HandlerDepth() { --handler_depth_; }
+};
+
+// Handlers overriding the stacks on the current thread
+thread_local cppkit::ErrorHandling::ErrorHandler
+    thread_handlers_[cppkit::CHAN_COUNT_] = {};
 }  // namespace
 
 namespace cppkit {
@@ -56,36 +90,66 @@ void ErrorHandling::pushHandler(int channel,
                                 ErrorHandling::ErrorHandler handler) {
   assert(channel >= 0);
   assert(channel < CHAN_COUNT_);
-  handlers_[channel].push_back(handler);
+  std::lock_guard<std::mutex> lock(handlers_mutex());
+  handler_stack(channel).push_back(handler);
+  top_handlers_[channel].store(handler, std::memory_order_release);
 }
 
 ErrorHandling::ErrorHandler ErrorHandling::popHandler(int channel) {
   assert(channel >= 0);
   assert(channel < CHAN_COUNT_);
-  assert(handlers_[channel].size() > 1);
-  ErrorHandler handler = handlers_[channel].back();
-  handlers_[channel].pop_back();
+  std::lock_guard<std::mutex> lock(handlers_mutex());
+  std::vector<ErrorHandler> &stack = handler_stack(channel);
+  assert(stack.size() > 1);
+  ErrorHandler handler = stack.back();
+  stack.pop_back();
+  top_handlers_[channel].store(stack.back(), std::memory_order_release);
   return handler;
 }
 
 void ErrorHandling::resetHandler(int channel,
                                  ErrorHandling::ErrorHandler handler) {
-  static const ErrorHandler default_handlers[CHAN_COUNT_] = {
-      handle_assert_error, handle_check_error, handle_require_error,
-      handle_ensure_error};
   assert(channel >= 0);
   assert(channel < CHAN_COUNT_);
-  if (!handler) handler = default_handlers[channel];
-  handlers_[channel].clear();
-  handlers_[channel].push_back(handler);
+  if (!handler) handler = default_handlers_[channel];
+  std::lock_guard<std::mutex> lock(handlers_mutex());
+  std::vector<ErrorHandler> &stack = handler_stack(channel);
+  stack.clear();
+  stack.push_back(handler);
+  top_handlers_[channel].store(handler, std::memory_order_release);
 }
 
-void ErrorHandling::handleError_(int channel, const std::string &file, int line,
-                                 const std::string &raw_expr,
-                                 const std::string &eval_expr) {
+ErrorHandling::ErrorHandler ErrorHandling::setThreadHandler(
+    int channel, ErrorHandling::ErrorHandler handler) {
   assert(channel >= 0);
   assert(channel < CHAN_COUNT_);
-  handlers_[channel].back()(file, line, raw_expr, eval_expr);
+  ErrorHandler previous = thread_handlers_[channel];
+  thread_handlers_[channel] = handler;
+  return previous;
+}
+
+void ErrorHandling::handleError_(const AssertionSite *site,
+                                 const char *eval_expr, size_t eval_size) {
+  assert(site->channel >= 0);
+  assert(site->channel < CHAN_COUNT_);
+  ErrorHandler handler = thread_handlers_[site->channel];
+  if (!handler) {
+    handler = top_handlers_[site->channel].load(std::memory_order_acquire);
+  }
+  // The handlers take strings, which are reused by every failure of the
+  // calling thread so they allocate only when outgrown. A nested failure gets
+  // its own, since the outer handler still reads the shared ones.
+  HandlerDepth depth;
+  if (handler_depth_ > 1) {
+    handler(site->file, site->line, site->expr,
+            std::string(eval_expr, eval_size));
+    return;
+  }
+  thread_local std::string file, raw_expr, eval;
+  file.assign(site->file);
+  raw_expr.assign(site->expr);
+  eval.assign(eval_expr, eval_size);
+  handler(file, site->line, raw_expr, eval);
 }
 
 }  // namespace cppkit
@@ -1,4 +1,7 @@
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <random>
 
 #include "TaskGraph.hpp"
 
@@ -30,9 +33,151 @@ void doTest() {
   auto result = tg.validate(true);
   if (!result.first) std::cerr << result.second << std::endl;
   std::cout << tg.toString() << std::endl;
+  // The frozen graph shall give the same validation result.
+  tg.freeze();
+  std::cout << "frozen: " << tg.taskCount() << " tasks, " << tg.edgeCount()
+            << " edges" << std::endl;
+  auto frozenResult = tg.validate(true);
+  if (!frozenResult.first) std::cerr << frozenResult.second << std::endl;
+  auto parallelResult = tg.validate(true, 4);
+  if (frozenResult.first != result.first ||
+      parallelResult != frozenResult) {
+    std::cerr << "frozen validation mismatch" << std::endl;
+    std::exit(1);
+  }
+}
+
+void doParallelValidationTest() {
+  // A layered graph whose frontiers are wide enough to validate in parallel,
+  // with and without a cycle through the lower layers.
+  const int width = 4096, depth = 16;
+  for (bool cyclic : {false, true}) {
+    std::vector<std::unique_ptr<SimpleTask>> tasks;
+    for (int i = 0; i < width * depth; i++) {
+      tasks.emplace_back(new SimpleTask(i));
+    }
+    for (int l = 0; l + 1 < depth; l++) {
+      for (int i = 0; i < width; i++) {
+        auto t = tasks[l * width + i].get();
+        t->addDownstreamTask(tasks[(l + 1) * width + i].get());
+        t->addDownstreamTask(tasks[(l + 1) * width + (i + 1) % width].get());
+      }
+    }
+    if (cyclic) {
+      tasks[(depth - 1) * width]->addDownstreamTask(
+          tasks[depth / 2 * width].get());
+    }
+    cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+    for (auto& t : tasks) tg.addTask(t.get());
+    tg.freeze();
+    auto serialResult = tg.validate(true, 1);
+    auto parallelResult = tg.validate(true, 4);
+    std::cout << "parallel validation of " << tg.taskCount()
+              << " tasks: " << (parallelResult.first ? "valid" : "invalid")
+              << std::endl;
+    if (serialResult.first == cyclic || parallelResult != serialResult) {
+      std::cerr << "parallel validation mismatch: " << parallelResult.second
+                << std::endl;
+      std::exit(1);
+    }
+  }
+}
+
+class CostTask : public cppkit::Task<cppkit::taskgraph::WithPriority> {
+public:
+  CostTask(int id, double cost)
+      : cppkit::Task<cppkit::taskgraph::WithPriority>(0.0),
+        id_(id),
+        cost_(cost) {}
+
+  bool progress() override { return true; }
+  bool finished() const override { return true; }
+  std::string id() const override { return std::to_string(id_); }
+  double cost() const { return cost_; }
+
+private:
+  int id_;
+  double cost_;
+};
+
+void doRankTest() {
+  // A diamond with a long left branch: 0 -> {1 -> 2, 3} -> 4
+  std::vector<std::unique_ptr<CostTask>> tasks;
+  const double costs[] = {1, 5, 5, 2, 1};
+  for (int i = 0; i < 5; i++) tasks.emplace_back(new CostTask(i, costs[i]));
+  tasks[0]->addDownstreamTask(tasks[1].get());
+  tasks[1]->addDownstreamTask(tasks[2].get());
+  tasks[2]->addDownstreamTask(tasks[4].get());
+  tasks[0]->addDownstreamTask(tasks[3].get());
+  tasks[3]->addDownstreamTask(tasks[4].get());
+  cppkit::TaskGraph<cppkit::taskgraph::WithPriority> tg;
+  for (auto& t : tasks) tg.addTask(t.get());
+  using BaseTask = cppkit::Task<cppkit::taskgraph::WithPriority>;
+  double criticalPath = tg.computeUpwardRanks([](const BaseTask* t) {
+    return static_cast<const CostTask*>(t)->cost();
+  });
+  std::cout << "critical path: " << criticalPath << std::endl;
+  for (auto& t : tasks) {
+    std::cout << "  rank(" << t->id() << ") = " << t->priority() << std::endl;
+  }
+  if (criticalPath != 12 || tasks[3]->priority() != 3) {
+    std::cerr << "wrong upward ranks" << std::endl;
+    std::exit(1);
+  }
+}
+
+void doIncrementalTest() {
+  using BaseTask = cppkit::Task<cppkit::taskgraph::WithTag>;
+  std::vector<std::unique_ptr<SimpleTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  for (int i = 0; i < 200; i++) {
+    tasks.emplace_back(new SimpleTask(i));
+    tg.addTask(tasks.back().get());
+  }
+  // Insert random edges, an edge is rejected iff it would close a cycle.
+  std::function<bool(BaseTask*, BaseTask*)> reaches = [&](BaseTask* a,
+                                                          BaseTask* b) {
+    if (a == b) return true;
+    for (auto d : a->downstreamTasks()) {
+      if (reaches(d, b)) return true;
+    }
+    return false;
+  };
+  std::mt19937 rng(11);
+  int rejected = 0;
+  for (int k = 0; k < 600; k++) {
+    auto a = tasks[rng() % tasks.size()].get();
+    auto b = tasks[rng() % tasks.size()].get();
+    bool cyclic = reaches(b, a);
+    if (tg.addEdge(a, b) == cyclic) {
+      std::cerr << "wrong cycle detection" << std::endl;
+      std::exit(1);
+    }
+    rejected += cyclic;
+  }
+  // Remove some tasks, the remaining ones are still in topological order.
+  for (int i = 0; i < 200; i += 7) tg.removeTask(tasks[i].get());
+  tg.foreach ([&tg](BaseTask* t) {
+    for (auto d : t->downstreamTasks()) {
+      if (tg.topologicalPosition(t) >= tg.topologicalPosition(d)) {
+        std::cerr << "wrong topological order" << std::endl;
+        std::exit(1);
+      }
+    }
+  })
+    ;
+  std::cout << "incremental: " << tg.taskCount() << " tasks, " << rejected
+            << " edges rejected" << std::endl;
+  if (!tg.revalidate().first || !tg.validate().first) {
+    std::cerr << "incremental validation failed" << std::endl;
+    std::exit(1);
+  }
 }
 
 int main(int argc, char* argv[]) {
   doTest();
+  doParallelValidationTest();
+  doRankTest();
+  doIncrementalTest();
   return 0;
 }
@@ -0,0 +1,674 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cppkit/TaskGraphExecutor.hpp>
+#include <cppkit/TaskGraphFile.hpp>
+#include <cppkit/TaskGraphPartition.hpp>
+#include <cppkit/assert.hpp>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+std::atomic<int> clock_{0};
+
+// Count the heap allocations, to check how their number scales
+std::atomic<long> allocations_{0};
+void* operator new(size_t size) {
+  allocations_++;
+  if (void* p = malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+class StampTask : public cppkit::Task<cppkit::taskgraph::WithTag> {
+public:
+  StampTask(int id, int tag)
+      : cppkit::Task<cppkit::taskgraph::WithTag>(tag), id_(id) {}
+
+  bool progress() override {
+    if (id_ == failingId_) throw std::runtime_error("task failed");
+    stamp_ = ++clock_;
+    runs_++;
+    return true;
+  }
+  bool finished() const override { return runs_ > 0; }
+  std::string id() const override { return std::to_string(id_); }
+
+  int stamp() const { return stamp_; }
+  int runs() const { return runs_; }
+  void clearRuns() { runs_ = 0; }
+
+  static int failingId_;
+
+private:
+  int id_;
+  int stamp_ = 0;
+  int runs_ = 0;
+};
+int StampTask::failingId_ = -1;
+
+// Build a random layered DAG
+void buildGraph(std::vector<std::unique_ptr<StampTask>>& tasks,
+                cppkit::TaskGraph<cppkit::taskgraph::WithTag>& tg) {
+  const int layers = 50, width = 200;
+  std::mt19937 rng(42);
+  for (int i = 0; i < layers * width; i++) {
+    tasks.emplace_back(new StampTask(i, i % 4));
+    if (i >= width) {
+      int layer = i / width;
+      for (int k = 0; k < 3; k++) {
+        int j = (layer - 1) * width + rng() % width;
+        tasks[j]->addDownstreamTask(tasks[i].get());
+      }
+    }
+  }
+  for (auto& t : tasks) tg.addTask(t.get());
+}
+
+void doTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  CPPKIT_CHECK_TRUE(tg.validate().first);
+
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(4);
+  for (int iter = 0; iter < 3; iter++) {
+    for (auto& t : tasks) t->clearRuns();
+    executor.run(tg);
+    for (auto& t : tasks) {
+      CPPKIT_CHECK_EQ(t->runs(), 1);
+      for (auto d : t->downstreamTasks()) {
+        CPPKIT_CHECK_LT(t->stamp(), static_cast<StampTask*>(d)->stamp());
+      }
+    }
+  }
+
+  // A throwing task aborts the run, the executor stays usable.
+  StampTask::failingId_ = 1234;
+  bool thrown = false;
+  try {
+    executor.run(tg);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  CPPKIT_CHECK_TRUE(thrown);
+  StampTask::failingId_ = -1;
+  executor.run(tg);
+}
+
+void doReplayTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  cppkit::ExecutableGraph<cppkit::taskgraph::WithTag> graph(tg);
+  CPPKIT_CHECK_EQ(graph.taskCount(), tasks.size());
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(4);
+  for (int iter = 0; iter < 20; iter++) {
+    for (auto& t : tasks) t->clearRuns();
+    executor.run(graph);
+    for (auto& t : tasks) {
+      CPPKIT_CHECK_EQ(t->runs(), 1);
+      for (auto d : t->downstreamTasks()) {
+        CPPKIT_CHECK_LT(t->stamp(), static_cast<StampTask*>(d)->stamp());
+      }
+    }
+  }
+}
+
+void doFileTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  char path[] = "/tmp/cppkit_taskgraph_XXXXXX";
+  int fd = mkstemp(path);
+  CPPKIT_CHECK_GE(fd, 0);
+  close(fd);
+  cppkit::saveTaskGraph(tg, path);
+
+  // Rebind fresh tasks without tags by id
+  cppkit::TaskGraphImage image(path);
+  CPPKIT_CHECK_EQ(image.taskCount(), tasks.size());
+  CPPKIT_CHECK_EQ(image.edgeCount(), tg.edgeCount());
+  CPPKIT_CHECK_TRUE(image.hasTags());
+  CPPKIT_CHECK_FALSE(image.hasPriorities());
+  std::vector<std::unique_ptr<StampTask>> copies;
+  std::unordered_map<std::string, StampTask*> byId;
+  for (size_t i = 0; i < tasks.size(); i++) {
+    copies.emplace_back(new StampTask(static_cast<int>(i), 0));
+    byId[copies.back()->id()] = copies.back().get();
+  }
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> loaded;
+  cppkit::loadTaskGraph(image, loaded, [&](const std::string& id) {
+    return byId.count(id) ? byId[id] : nullptr;
+  });
+  CPPKIT_CHECK_EQ(loaded.taskCount(), tg.taskCount());
+  CPPKIT_CHECK_EQ(loaded.edgeCount(), tg.edgeCount());
+  for (size_t i = 0; i < tasks.size(); i++) {
+    auto a = tasks[i].get();
+    auto b = copies[i].get();
+    CPPKIT_CHECK_EQ(a->tag(), b->tag());
+    std::vector<std::string> ea, eb;
+    for (auto d : a->downstreamTasks()) ea.push_back(d->id());
+    for (auto d : b->downstreamTasks()) eb.push_back(d->id());
+    std::sort(ea.begin(), ea.end());
+    std::sort(eb.begin(), eb.end());
+    CPPKIT_CHECK_TRUE(ea == eb);
+  }
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(4);
+  executor.run(loaded);
+  for (auto& t : copies) {
+    CPPKIT_CHECK_EQ(t->runs(), 1);
+    for (auto d : t->downstreamTasks()) {
+      CPPKIT_CHECK_LT(t->stamp(), static_cast<StampTask*>(d)->stamp());
+    }
+  }
+
+  // An unknown id and a truncated file are rejected.
+  bool thrown = false;
+  try {
+    cppkit::TaskGraph<cppkit::taskgraph::WithTag> g;
+    cppkit::loadTaskGraph(image, g, [](const std::string&) {
+      return static_cast<StampTask*>(nullptr);
+    });
+  } catch (const std::invalid_argument&) {
+    thrown = true;
+  }
+  CPPKIT_CHECK_TRUE(thrown);
+  CPPKIT_CHECK_EQ(truncate(path, 100), 0);
+  thrown = false;
+  try {
+    cppkit::TaskGraphImage truncated(path);
+  } catch (const std::runtime_error&) {
+    thrown = true;
+  }
+  CPPKIT_CHECK_TRUE(thrown);
+  unlink(path);
+}
+
+void doEmplaceTest() {
+  // A fork-join of lambdas owned by the graph
+  const int width = 1000;
+  std::vector<int> values(width, 0);
+  int sum = 0;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  auto join = tg.emplace([&] {
+    for (auto v : values) sum += v;
+  }, 0);
+  for (int i = 0; i < width; i++) {
+    auto t = tg.emplace([&values, i] { values[i] = i; }, i % 4);
+    t->addDownstreamTask(join);
+  }
+  CPPKIT_CHECK_EQ(tg.taskCount(), static_cast<size_t>(width + 1));
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(4);
+  executor.run(tg);
+  CPPKIT_CHECK_EQ(sum, width * (width - 1) / 2);
+  CPPKIT_CHECK_TRUE(join->finished());
+  // Emplacing costs the same in a large graph as in a small one
+  cppkit::TaskGraph<> large;
+  auto emplaceBatch = [&large] {
+    long before = allocations_;
+    for (int i = 0; i < 10000; i++) large.emplace([] {});
+    return allocations_ - before;
+  };
+  long first = emplaceBatch();
+  for (int k = 0; k < 10; k++) emplaceBatch();
+  long last = emplaceBatch();
+  std::cout << "emplace allocations: " << first << " then " << last
+            << std::endl;
+  CPPKIT_CHECK_LT(first, 1000);
+  CPPKIT_CHECK_LE(last, 2 * first);
+}
+
+void doFlowTest() {
+  // Chunks of move-only buffers reduced pairwise; the buffers are released
+  // while the run proceeds.
+  const int width = 64;
+  std::atomic<int> live{0};
+  struct Buffer {
+    Buffer(std::atomic<int>& live, int v) : live(&live), data(new int(v)) {
+      live++;
+    }
+    Buffer(Buffer&& b) : live(b.live), data(std::move(b.data)) {
+      b.live = nullptr;
+    }
+    ~Buffer() {
+      if (live) (*live)--;
+    }
+    std::atomic<int>* live;
+    std::unique_ptr<int> data;
+  };
+  cppkit::TaskGraph<> tg;
+  std::vector<cppkit::Future<Buffer>> level;
+  for (int i = 0; i < width; i++) {
+    level.push_back(tg.emplaceFlow([&live, i] { return Buffer(live, i); }));
+  }
+  while (level.size() > 1) {
+    std::vector<cppkit::Future<Buffer>> next;
+    for (size_t i = 0; i < level.size(); i += 2) {
+      next.push_back(tg.emplaceFlow(
+          [&live](Buffer& a, Buffer& b) {
+            return Buffer(live, *a.data + *b.data);
+          },
+          level[i], level[i + 1]));
+    }
+    level = std::move(next);
+  }
+  // Two consumers sharing one input, and a sink returning nothing
+  auto total = level.front();
+  auto twice = tg.emplaceFlow([](Buffer& b) { return *b.data * 2; }, total);
+  auto square =
+      tg.emplaceFlow([](Buffer& b) { return *b.data * *b.data; }, total);
+  int result = 0;
+  auto sink = tg.emplaceFlow([&result](int& a, int& b) { result = a + b; },
+                             twice, square);
+  CPPKIT_CHECK_EQ(tg.taskCount(), static_cast<size_t>(2 * width + 2));
+  cppkit::TaskGraphExecutor<> executor(4);
+  for (int run = 0; run < 2; run++) {
+    result = 0;
+    executor.run(tg);
+    const int s = width * (width - 1) / 2;
+    CPPKIT_CHECK_EQ(result, 2 * s + s * s);
+    CPPKIT_CHECK_EQ(live.load(), 0);
+    CPPKIT_CHECK_FALSE(total.ready());
+    CPPKIT_CHECK_FALSE(twice.ready());
+    CPPKIT_CHECK_TRUE(sink.task()->finished());
+  }
+  // An output without consumers keeps its value.
+  auto last = tg.emplaceFlow([](int& a) { return a + 1; }, square);
+  executor.run(tg);
+  CPPKIT_CHECK_TRUE(last.ready());
+  const int s = width * (width - 1) / 2;
+  CPPKIT_CHECK_EQ(last.get(), s * s + 1);
+}
+
+void doBudgetTest() {
+  // Independent tasks of 100 bytes each under a budget of 300 bytes
+  std::atomic<int> running{0};
+  std::atomic<int> maxRunning{0};
+  cppkit::TaskGraph<> tg;
+  for (int i = 0; i < 64; i++) {
+    auto t = tg.emplace([&] {
+      int n = ++running;
+      int m = maxRunning.load();
+      while (n > m && !maxRunning.compare_exchange_weak(m, n)) {
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      running--;
+    });
+    t->setResources({100, 0, 0});
+  }
+  cppkit::taskgraph::ExecutorOptions options;
+  options.threadCount = 8;
+  options.budget.memory = 300;
+  cppkit::TaskGraphExecutor<> executor(options);
+  executor.run(tg);
+  CPPKIT_CHECK_LE(maxRunning.load(), 3);
+  CPPKIT_CHECK_EQ(executor.peakMemory(), static_cast<int64_t>(300));
+
+  // With room for one task, the released tasks run in order of the memory
+  // they free.
+  std::vector<int> order;
+  cppkit::TaskGraph<> chain;
+  auto source = chain.emplace([] {});
+  source->setResources({100, 0, 0});
+  const int freed[] = {30, 10, 70, 0, 50, 20, 60, 40};
+  for (auto f : freed) {
+    auto t = chain.emplace([&order, f] { order.push_back(f); });
+    t->setResources({100, 0, f});
+    source->addDownstreamTask(t);
+  }
+  options.budget.memory = 100;
+  cppkit::TaskGraphExecutor<> serial(options);
+  serial.run(chain);
+  CPPKIT_CHECK_EQ(order.size(), static_cast<size_t>(8));
+  for (size_t i = 1; i < order.size(); i++) {
+    CPPKIT_CHECK_GT(order[i - 1], order[i]);
+  }
+
+  // A task exceeding the budget runs alone, and I/O slots are gated too.
+  tg.clear();
+  running = maxRunning = 0;
+  for (int i = 0; i < 16; i++) {
+    auto t = tg.emplace([&] {
+      int n = ++running;
+      int m = maxRunning.load();
+      while (n > m && !maxRunning.compare_exchange_weak(m, n)) {
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      running--;
+    });
+    t->setResources({i == 0 ? 1000 : 0, 1, 0});
+  }
+  options.budget.ioSlots = 2;
+  cppkit::TaskGraphExecutor<> io(options);
+  io.run(tg);
+  CPPKIT_CHECK_LE(maxRunning.load(), 2);
+  CPPKIT_CHECK_EQ(io.peakMemory(), static_cast<int64_t>(1000));
+}
+
+void doTraceTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  cppkit::taskgraph::ExecutorOptions options;
+  options.threadCount = 4;
+  options.tracing = true;
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(options);
+  executor.run(tg);
+  auto trace = executor.trace();
+  CPPKIT_CHECK_EQ(trace.workerCount, 4);
+  CPPKIT_CHECK_EQ(trace.events.size(), tasks.size());
+  for (auto& e : trace.events) {
+    CPPKIT_CHECK_LE(e.ready, e.start);
+    CPPKIT_CHECK_LE(e.start, e.end);
+    CPPKIT_CHECK_LE(e.end, trace.duration);
+  }
+  // The realized critical path follows the edges of the graph.
+  auto stats = trace.stats();
+  CPPKIT_CHECK_GT(stats.utilization, 0.0);
+  CPPKIT_CHECK_LE(stats.utilization, 1.0);
+  CPPKIT_CHECK_FALSE(stats.criticalPathTasks.empty());
+  CPPKIT_CHECK_EQ(tg.taskAt(stats.criticalPathTasks[0])->upstreamCount(), 0);
+  for (size_t i = 1; i < stats.criticalPathTasks.size(); i++) {
+    auto t = tg.taskAt(stats.criticalPathTasks[i - 1]);
+    CPPKIT_CHECK_EQ(
+        t->downstreamTasks().count(tg.taskAt(stats.criticalPathTasks[i])),
+        1u);
+  }
+  CPPKIT_CHECK_EQ(trace.toChromeTrace().find("{\"displayTimeUnit\""), 0u);
+}
+
+void doSubgraphTest() {
+  // a -> s -> b, where s is a fork-join of 100 tasks and a nested subgraph
+  std::atomic<int> stamp{0}, aStamp{0}, bStamp{0}, childCount{0};
+  std::atomic<int> firstChild{1 << 30}, lastChild{0};
+  auto child = [&] {
+    int t = ++stamp;
+    int v = firstChild.load();
+    while (t < v && !firstChild.compare_exchange_weak(v, t)) {
+    }
+    v = lastChild.load();
+    while (t > v && !lastChild.compare_exchange_weak(v, t)) {
+    }
+    childCount++;
+  };
+  cppkit::TaskGraph<> tg;
+  auto a = tg.emplace([&] { aStamp = ++stamp; });
+  auto b = tg.emplace([&] { bStamp = ++stamp; });
+  cppkit::SubgraphTask<> s("s"), nested("nested");
+  tg.addTask(&s);
+  a->addDownstreamTask(&s);
+  s.addDownstreamTask(b);
+  auto fork = s.graph().emplace(child);
+  auto join = s.graph().emplace(child);
+  for (int i = 0; i < 100; i++) {
+    auto t = s.graph().emplace(child);
+    fork->addDownstreamTask(t);
+    t->addDownstreamTask(join);
+  }
+  s.graph().addTask(&nested);
+  fork->addDownstreamTask(&nested);
+  nested.addDownstreamTask(join);
+  for (int i = 0; i < 10; i++) nested.graph().emplace(child);
+
+  cppkit::TaskGraphExecutor<> executor(4);
+  for (int iter = 0; iter < 3; iter++) {
+    childCount = 0;
+    firstChild = 1 << 30;
+    lastChild = 0;
+    executor.run(tg);
+    CPPKIT_CHECK_EQ(childCount.load(), 112);
+    CPPKIT_CHECK_LT(aStamp.load(), firstChild.load());
+    CPPKIT_CHECK_LT(lastChild.load(), bStamp.load());
+    CPPKIT_CHECK_TRUE(s.finished());
+  }
+}
+
+void doCoarsenTest() {
+  // 100 chains of 50 tasks, joined pairwise by cross edges
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  const int chains = 100, length = 50;
+  for (int i = 0; i < chains * length; i++) {
+    tasks.emplace_back(new StampTask(i, 0));
+    if (i % length != 0) tasks[i - 1]->addDownstreamTask(tasks[i].get());
+    tg.addTask(tasks.back().get());
+  }
+  for (int c = 1; c < chains; c++) {
+    tasks[(c - 1) * length + 20]->addDownstreamTask(
+        tasks[c * length + 30].get());
+  }
+  using BaseTask = cppkit::Task<cppkit::taskgraph::WithTag>;
+  auto coarse = tg.coarsen([](const BaseTask*) { return 1.0; }, 10);
+  CPPKIT_CHECK_TRUE(coarse.validate().first);
+  CPPKIT_CHECK_LE(coarse.taskCount() * 8, tg.taskCount());
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(4);
+  executor.run(coarse);
+  for (auto& t : tasks) {
+    CPPKIT_CHECK_EQ(t->runs(), 1);
+    for (auto d : t->downstreamTasks()) {
+      CPPKIT_CHECK_LT(t->stamp(), static_cast<StampTask*>(d)->stamp());
+    }
+  }
+}
+
+void doPartitionTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  const int k = 3;
+  auto parts = cppkit::partitionGraph(tg, k);
+  std::vector<size_t> sizes(k, 0);
+  for (auto p : parts) sizes[p]++;
+  for (auto size : sizes) CPPKIT_CHECK_LE(size, tasks.size() * 11 / 10 / k);
+  CPPKIT_CHECK_LT(cppkit::cutEdgeCount(tg, parts), tg.edgeCount() * 3 / 4);
+
+  // Run every part on its own thread as if in its own process.
+  char directory[] = "/tmp/cppkit_partition_XXXXXX";
+  CPPKIT_CHECK_TRUE(mkdtemp(directory) != nullptr);
+  std::vector<std::thread> ranks;
+  for (int rank = 0; rank < k; rank++) {
+    ranks.emplace_back([&, rank] {
+      cppkit::taskgraph::UnixSocketTransport transport(directory, rank);
+      cppkit::PartitionedGraph<cppkit::taskgraph::WithTag> part(
+          tg, parts, rank, transport);
+      cppkit::taskgraph::ExecutorOptions options;
+      options.threadCount = 2;
+      options.pollingThread = true;
+      cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(options);
+      for (int iter = 0; iter < 2; iter++) executor.run(part.graph());
+    });
+  }
+  for (auto& r : ranks) r.join();
+  rmdir(directory);
+  for (auto& t : tasks) {
+    CPPKIT_CHECK_EQ(t->runs(), 2);
+    for (auto d : t->downstreamTasks()) {
+      CPPKIT_CHECK_LT(t->stamp(), static_cast<StampTask*>(d)->stamp());
+    }
+  }
+}
+
+class PriorityTask : public cppkit::Task<cppkit::taskgraph::WithPriority> {
+public:
+  PriorityTask(int id, double priority, std::vector<double>* order)
+      : cppkit::Task<cppkit::taskgraph::WithPriority>(priority),
+        id_(id),
+        order_(order) {}
+
+  bool progress() override {
+    if (order_) order_->push_back(priority());
+    return true;
+  }
+  bool finished() const override { return true; }
+  std::string id() const override { return std::to_string(id_); }
+
+private:
+  int id_;
+  std::vector<double>* order_;
+};
+
+// A task either raising a flag, or unfinished until the flag is raised
+class FlagTask : public cppkit::Task<cppkit::taskgraph::WithPriority> {
+public:
+  FlagTask(double priority, bool raise, std::atomic<bool>* flag)
+      : cppkit::Task<cppkit::taskgraph::WithPriority>(priority),
+        raise_(raise),
+        flag_(flag) {}
+
+  bool progress() override {
+    if (raise_) flag_->store(true);
+    finished_ = flag_->load();
+    return finished_;
+  }
+  bool finished() const override { return finished_; }
+  std::string id() const override { return raise_ ? "raise" : "wait"; }
+
+private:
+  bool raise_;
+  bool finished_ = false;
+  std::atomic<bool>* flag_;
+};
+
+void doPriorityTest() {
+  std::vector<double> order;
+  std::vector<std::unique_ptr<PriorityTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithPriority> tg;
+  std::mt19937 rng(7);
+  for (int i = 0; i < 1000; i++) {
+    tasks.emplace_back(new PriorityTask(i, rng() % 100, &order));
+    tg.addTask(tasks.back().get());
+  }
+  cppkit::taskgraph::ExecutorOptions options;
+  options.threadCount = 1;
+  options.policy = cppkit::taskgraph::SchedulingPolicy::Priority;
+  {
+    // A single worker dispatches in exact priority order.
+    cppkit::TaskGraphExecutor<cppkit::taskgraph::WithPriority> executor(
+        options);
+    executor.run(tg);
+    CPPKIT_CHECK_EQ(order.size(), tasks.size());
+    for (size_t i = 1; i < order.size(); i++) {
+      CPPKIT_CHECK_GE(order[i - 1], order[i]);
+    }
+  }
+  // Several workers still run every task exactly once.
+  for (auto& t : tasks) t.reset(new PriorityTask(0, rng() % 100, nullptr));
+  tg.clear();
+  for (size_t i = 0; i < tasks.size(); i++) {
+    if (i >= 10) tasks[i - 10]->addDownstreamTask(tasks[i].get());
+    tg.addTask(tasks[i].get());
+  }
+  options.threadCount = 4;
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithPriority> executor(options);
+  executor.run(tg);
+  for (auto& t : tasks) CPPKIT_CHECK_EQ(t->pendingUpstreamCount(), 0);
+  // An unfinished task does not starve the lower priority task it waits on.
+  std::atomic<bool> flag{false};
+  FlagTask wait(10, false, &flag), raise(1, true, &flag);
+  cppkit::TaskGraph<cppkit::taskgraph::WithPriority> waiting;
+  waiting.addTask(&wait);
+  waiting.addTask(&raise);
+  options.threadCount = 1;
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithPriority> single(options);
+  single.run(waiting);
+  CPPKIT_CHECK_TRUE(wait.finished());
+}
+
+void doPoolTest() {
+  std::vector<std::unique_ptr<StampTask>> tasks;
+  cppkit::TaskGraph<cppkit::taskgraph::WithTag> tg;
+  buildGraph(tasks, tg);
+  cppkit::taskgraph::ExecutorOptions options;
+  options.pools.resize(2);
+  options.pools[0].threadCount = 2;
+  options.pools[0].tags = {0, 1};
+  options.pools[1].threadCount = 2;
+  options.pools[1].tags = {2};
+  options.pools[1].cpus = cppkit::taskgraph::numaNodeCpus(0);
+  options.pools[1].shareCpus = true;
+  // Tag 3 is not bound to any pool.
+  cppkit::TaskGraphExecutor<cppkit::taskgraph::WithTag> executor(options);
+  CPPKIT_CHECK_EQ(executor.threadCount(), 4);
+  executor.run(tg);
+  for (auto& t : tasks) CPPKIT_CHECK_EQ(t->runs(), 1);
+}
+
+// A task waiting for an asynchronous operation completing after a delay
+class AsyncTask : public cppkit::Task<> {
+public:
+  AsyncTask(int id, int delayMicroseconds)
+      : id_(id), delay_(delayMicroseconds) {}
+
+  bool progress() override {
+    auto now = std::chrono::steady_clock::now();
+    if (!started_) {
+      started_ = true;
+      deadline_ = now + std::chrono::microseconds(delay_);
+    }
+    polls_++;
+    return finished();
+  }
+  bool finished() const override {
+    return started_ && std::chrono::steady_clock::now() >= deadline_;
+  }
+  std::string id() const override { return std::to_string(id_); }
+  int polls() const { return polls_; }
+
+private:
+  int id_;
+  int delay_;
+  bool started_ = false;
+  int polls_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+void doPollingTest() {
+  std::vector<std::unique_ptr<AsyncTask>> tasks;
+  cppkit::TaskGraph<> tg;
+  for (int i = 0; i < 200; i++) {
+    tasks.emplace_back(new AsyncTask(i, i % 2 ? 2000 : 0));
+    if (i >= 20) tasks[i - 20]->addDownstreamTask(tasks[i].get());
+    tg.addTask(tasks.back().get());
+  }
+  cppkit::taskgraph::ExecutorOptions options;
+  options.threadCount = 2;
+  options.pollingThread = true;
+  cppkit::TaskGraphExecutor<> executor(options);
+  executor.run(tg);
+  for (auto& t : tasks) CPPKIT_CHECK_TRUE(t->finished());
+}
+
+int main(int argc, char* argv[]) {
+  doTest();
+  doReplayTest();
+  doFileTest();
+  doEmplaceTest();
+  doFlowTest();
+  doBudgetTest();
+  doTraceTest();
+  doSubgraphTest();
+  doCoarsenTest();
+  doPartitionTest();
+  doPriorityTest();
+  doPoolTest();
+  doPollingTest();
+  std::cout << "OK" << std::endl;
+  return 0;
+}
@@ -1,8 +1,202 @@
 #include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <cppkit/assert.hpp>
 #include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+std::string last_failure;
+void record_failure(const std::string& file, int line,
+                    const std::string& raw_expr, const std::string& eval_expr) {
+  last_failure = raw_expr + " | " + eval_expr;
+}
+
+void do_failure_test() {
+  // Operands are evaluated once, whether the check passes or fails
+  int calls = 0;
+  auto next = [&calls] { return ++calls; };
+  CPPKIT_CHECK_EQ(next(), 1);
+  std::string message;
+  try {
+    CPPKIT_CHECK_LT(next(), 0);
+  } catch (const std::logic_error& e) {
+    message = e.what();
+  }
+  if (calls != 2 ||
+      message.find("check(next() < 0) failed, values (2 < 0)") ==
+          std::string::npos) {
+    std::cerr << "unexpected failure: " << message << std::endl;
+    std::abort();
+  }
+  // A handler receives the description of the site
+  cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK, record_failure);
+  int x = 1;
+  CPPKIT_CHECK_EQ(x + 1, 3);
+  cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  if (last_failure != "x + 1 == 3 | 2 == 3") {
+    std::cerr << "unexpected failure: " << last_failure << std::endl;
+    std::abort();
+  }
+}
+
+void do_format_test() {
+  // Containers are rendered up to a bounded number of elements
+  cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK, record_failure);
+  std::map<std::string, int> m{{"a", 1}, {"b", 2}}, empty;
+  CPPKIT_CHECK_EQ(m, empty);
+  if (last_failure != "m == empty | {\"a\": 1, \"b\": 2} == {}") {
+    std::cerr << "unexpected failure: " << last_failure << std::endl;
+    std::abort();
+  }
+  // String literals are quoted like strings
+  std::string s = "world";
+  CPPKIT_CHECK_EQ(s, "hello");
+  if (last_failure != "s == \"hello\" | \"world\" == \"hello\"") {
+    std::cerr << "unexpected failure: " << last_failure << std::endl;
+    std::abort();
+  }
+  std::vector<int> v(1000, 7);
+  CPPKIT_CHECK_NE(v, v);
+  cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  std::string expected = "v != v | [";
+  for (int i = 0; i < CPPKIT_ASSERT_MAX_CONTAINER_ELEMENTS; i++) {
+    expected += "7, ";
+  }
+  expected += "... (984 more)] != [";
+  if (last_failure.compare(0, expected.size(), expected) != 0) {
+    std::cerr << "unexpected failure: " << last_failure << std::endl;
+    std::abort();
+  }
+  // Messages are not truncated
+  std::string message;
+  try {
+    CPPKIT_CHECK_EQ(std::string(2000, 'x'), "");
+  } catch (const std::logic_error& e) {
+    message = e.what();
+  }
+  if (message.size() < 2000 || message.back() != ')') {
+    std::cerr << "unexpected failure: " << message << std::endl;
+    std::abort();
+  }
+}
+
+// A handler failing a check itself, which reaches the same handler
+std::vector<std::string> nested_failures;
+void nesting_failure(const std::string& file, int line,
+                     const std::string& raw_expr,
+                     const std::string& eval_expr) {
+  static bool nested = false;
+  if (!nested) {
+    nested = true;
+    int inner = 2;
+    CPPKIT_CHECK_EQ(inner, 3);
+    nested = false;
+  }
+  nested_failures.push_back(raw_expr + " | " + eval_expr);
+}
+
+// A value whose rendering fails a check
+struct Noisy {
+  int v;
+  bool operator==(const Noisy& other) const { return v == other.v; }
+};
+std::ostream& operator<<(std::ostream& os, const Noisy& n) {
+  int zero = 0;
+  CPPKIT_CHECK_EQ(zero, 1);
+  return os << "Noisy(" << n.v << ")";
+}
+
+void do_nested_test() {
+  // Failures reported while another one is keep their own messages
+  cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK, nesting_failure);
+  int outer = 0;
+  CPPKIT_CHECK_EQ(outer, 1);
+  Noisy a{1}, b{2};
+  CPPKIT_CHECK_EQ(a, b);
+  cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  const std::vector<std::string> expected = {
+      "inner == 3 | 2 == 3", "outer == 1 | 0 == 1",  "inner == 3 | 2 == 3",
+      "zero == 1 | 0 == 1",  "inner == 3 | 2 == 3",  "zero == 1 | 0 == 1",
+      "inner == 3 | 2 == 3", "a == b | Noisy(1) == Noisy(2)"};
+  if (nested_failures != expected) {
+    for (auto& f : nested_failures) std::cerr << f << std::endl;
+    std::abort();
+  }
+}
+
+int failure_count = 0;
+void count_failure(const std::string& file, int line,
+                   const std::string& raw_expr, const std::string& eval_expr) {
+  failure_count++;
+}
+
+void do_sampled_test() {
+  // Every 4th pass is evaluated
+  int calls = 0;
+  auto next = [&calls] { return ++calls; };
+  for (int i = 0; i < 100; i++) CPPKIT_CHECK_SAMPLED_GT(4, next(), 0);
+  // About half of the passes are evaluated
+  int sampled = 0;
+  auto count = [&sampled] { return ++sampled; };
+  for (int i = 0; i < 10000; i++) CPPKIT_CHECK_SAMPLED_GT(0.5, count(), 0);
+  // Failures of a site are rate limited before reaching the handler
+  cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK, count_failure);
+  for (int i = 0; i < 1000; i++) CPPKIT_CHECK_SAMPLED_EQ(1, i, -1);
+  cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  if (calls != 25 || sampled < 4500 || sampled > 5500 || failure_count < 1 ||
+      failure_count > 2 * CPPKIT_ASSERT_SAMPLED_FAILURE_LIMIT) {
+    std::cerr << "unexpected sampling: " << calls << ", " << sampled << ", "
+              << failure_count << std::endl;
+    std::abort();
+  }
+}
+
+std::atomic<int> concurrent_failures{0};
+void count_concurrent_failure(const std::string& file, int line,
+                              const std::string& raw_expr,
+                              const std::string& eval_expr) {
+  concurrent_failures++;
+}
+thread_local int thread_failures = 0;
+void count_thread_failure(const std::string& file, int line,
+                          const std::string& raw_expr,
+                          const std::string& eval_expr) {
+  thread_failures++;
+}
+
+void do_concurrent_test() {
+  // Threads fail checks while the handler stack changes
+  cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK,
+                                     count_concurrent_failure);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([t] {
+      // One thread overrides the handler for itself
+      if (t == 0) {
+        cppkit::ErrorHandling::setThreadHandler(cppkit::CHAN_CHECK,
+                                                count_thread_failure);
+      }
+      for (int i = 0; i < 1000; i++) CPPKIT_CHECK_LT(i, 0);
+      if (t == 0 && thread_failures != 1000) std::abort();
+    });
+  }
+  for (int i = 0; i < 1000; i++) {
+    cppkit::ErrorHandling::pushHandler(cppkit::CHAN_CHECK,
+                                       count_concurrent_failure);
+    cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  }
+  for (auto& t : threads) t.join();
+  cppkit::ErrorHandling::popHandler(cppkit::CHAN_CHECK);
+  if (concurrent_failures != 3000 || thread_failures != 0) {
+    std::cerr << "unexpected failures: " << concurrent_failures << std::endl;
+    std::abort();
+  }
+}
+
 void do_test() {
   int a = 2;
   CPPKIT_REQUIRE_GT(a, 1);
@@ -15,6 +209,11 @@ void do_test() {
 }
 
 int main(int argc, char* argv[]) {
+  do_failure_test();
+  do_format_test();
+  do_nested_test();
+  do_sampled_test();
+  do_concurrent_test();
   do_test();
   return 0;
 }
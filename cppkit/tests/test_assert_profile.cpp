@@ -0,0 +1,73 @@
+#define CPPKIT_ASSERT_ENABLE_PROFILER 1
+#define CPPKIT_ASSERT_PROFILE_CYCLES 1
+#define CPPKIT_ASSERT_PROFILE_REPORT_AT_EXIT 0
+
+#include <cppkit/assert.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+int hot(int i) {
+  CPPKIT_CHECK_GE(i, 0);
+  return i + 1;
+}
+
+void cold(int i) { CPPKIT_CHECK_LT(i, 5); }
+
+void fail(const std::string& message) {
+  std::cerr << "unexpected profile: " << message << std::endl;
+  cppkit::reportAssertionProfile();
+  std::abort();
+}
+
+void do_profile_test() {
+  // Sites are counted from their first evaluation
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([] {
+      for (int i = 0; i < 10000; i++) hot(i);
+    });
+  }
+  for (auto& t : threads) t.join();
+  int failures = 0;
+  for (int i = 0; i < 10; i++) {
+    try {
+      cold(i);
+    } catch (const std::logic_error&) {
+      failures++;
+    }
+  }
+  for (int i = 0; i < 1000; i++) CPPKIT_CHECK_SAMPLED_GE(10, i, 0);
+  auto profiles = cppkit::assertionProfile();
+  if (profiles.size() != 3) fail("3 sites");
+  if (failures != 5) fail("5 failures");
+  for (const auto& p : profiles) {
+    std::string expr = p.site->expr;
+    if (expr == "i >= 0" && p.site->channel == cppkit::CHAN_CHECK &&
+        p.evaluations == 40000) {
+      if (p.failures != 0 || p.cycles == 0) fail(expr);
+    } else if (expr == "i < 5") {
+      if (p.evaluations != 10 || p.failures != 5) fail(expr);
+    } else if (expr == "i >= 0") {
+      if (p.evaluations != 100 || p.failures != 0) fail("sampled " + expr);
+    } else {
+      fail(expr);
+    }
+  }
+  // Counters restart from zero, and the evaluated sites come first
+  cppkit::resetAssertionProfile();
+  hot(0);
+  profiles = cppkit::assertionProfile();
+  if (profiles.size() != 3 || profiles.front().evaluations != 1) {
+    fail("reset");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  do_profile_test();
+  cppkit::reportAssertionProfile(stdout);
+  return 0;
+}
@@ -28,7 +28,62 @@ enum blake3_flags {
 #define INLINE static inline __attribute__((always_inline))
 #endif
 
+// Detect x86
+#if defined(__x86_64__) || defined(_M_X64)
+#define IS_X86
+#define IS_X86_64
+#endif
+
+#if defined(__i386__) || defined(_M_IX86)
+#define IS_X86
+#define IS_X86_32
+#endif
+
+// The SIMD implementations are selected at runtime by blake3_dispatch.c.
+// Define BLAKE3_NO_SSE2, BLAKE3_NO_SSE41, BLAKE3_NO_AVX2 or BLAKE3_NO_AVX512
+// to leave one out of the build.
+#if defined(IS_X86)
+#define MAX_SIMD_DEGREE 16
+#else
 #define MAX_SIMD_DEGREE 1
+#endif
+
+// The CPU features selecting the SIMD implementations
+enum cpu_feature {
+  SSE2 = 1 << 0,
+  SSE41 = 1 << 1,
+  AVX2 = 1 << 2,
+  AVX512F = 1 << 3,
+  /* ... */
+  UNDEFINED = 1 << 30
+};
+
+// An int read and written atomically with relaxed ordering, for the features
+// cached by the dispatch, which any thread may detect first.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define ATOMIC_INT long
+#define ATOMIC_LOAD(x) _InterlockedOr((volatile long *)&(x), 0)
+#define ATOMIC_STORE(x, y) _InterlockedExchange((volatile long *)&(x), (y))
+#elif defined(__GNUC__)
+#define ATOMIC_INT int
+#define ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define ATOMIC_STORE(x, y) __atomic_store_n(&(x), (y), __ATOMIC_RELAXED)
+#else
+#include <stdatomic.h>
+#define ATOMIC_INT _Atomic int
+#define ATOMIC_LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+#define ATOMIC_STORE(x, y) \
+  atomic_store_explicit(&(x), (y), memory_order_relaxed)
+#endif
+
+#if defined(BLAKE3_TESTING)
+// The features used by the dispatch, detected on first use. Tests store into
+// them with ATOMIC_STORE to force an implementation, e.g., 0 for the portable
+// one.
+extern ATOMIC_INT g_cpu_features;
+enum cpu_feature get_cpu_features(void);
+#endif
 
 // There are some places where we want a static size that's equal to the
 // MAX_SIMD_DEGREE, but also at least 2.
@@ -155,4 +210,51 @@ void blake3_hash_many_portable(const uint8_t *const *inputs, size_t num_inputs,
                                uint8_t flags, uint8_t flags_start,
                                uint8_t flags_end, uint8_t *out);
 
+#if defined(IS_X86)
+#if !defined(BLAKE3_NO_SSE2)
+void blake3_compress_in_place_sse2(uint32_t cv[8],
+                                   const uint8_t block[BLAKE3_BLOCK_LEN],
+                                   uint8_t block_len, uint64_t counter,
+                                   uint8_t flags);
+void blake3_compress_xof_sse2(const uint32_t cv[8],
+                              const uint8_t block[BLAKE3_BLOCK_LEN],
+                              uint8_t block_len, uint64_t counter,
+                              uint8_t flags, uint8_t out[64]);
+void blake3_hash_many_sse2(const uint8_t *const *inputs, size_t num_inputs,
+                           size_t blocks, const uint32_t key[8],
+                           uint64_t counter, bool increment_counter,
+                           uint8_t flags, uint8_t flags_start,
+                           uint8_t flags_end, uint8_t *out);
+#endif
+#if !defined(BLAKE3_NO_SSE41)
+void blake3_compress_in_place_sse41(uint32_t cv[8],
+                                    const uint8_t block[BLAKE3_BLOCK_LEN],
+                                    uint8_t block_len, uint64_t counter,
+                                    uint8_t flags);
+void blake3_compress_xof_sse41(const uint32_t cv[8],
+                               const uint8_t block[BLAKE3_BLOCK_LEN],
+                               uint8_t block_len, uint64_t counter,
+                               uint8_t flags, uint8_t out[64]);
+void blake3_hash_many_sse41(const uint8_t *const *inputs, size_t num_inputs,
+                            size_t blocks, const uint32_t key[8],
+                            uint64_t counter, bool increment_counter,
+                            uint8_t flags, uint8_t flags_start,
+                            uint8_t flags_end, uint8_t *out);
+#endif
+#if !defined(BLAKE3_NO_AVX2)
+void blake3_hash_many_avx2(const uint8_t *const *inputs, size_t num_inputs,
+                           size_t blocks, const uint32_t key[8],
+                           uint64_t counter, bool increment_counter,
+                           uint8_t flags, uint8_t flags_start,
+                           uint8_t flags_end, uint8_t *out);
+#endif
+#if !defined(BLAKE3_NO_AVX512)
+void blake3_hash_many_avx512(const uint8_t *const *inputs, size_t num_inputs,
+                             size_t blocks, const uint32_t key[8],
+                             uint64_t counter, bool increment_counter,
+                             uint8_t flags, uint8_t flags_start,
+                             uint8_t flags_end, uint8_t *out);
+#endif
+#endif
+
 #endif /* BLAKE3_IMPL_H */
@@ -0,0 +1,107 @@
+// Check that every SIMD implementation of BLAKE3 available on this CPU gives
+// the same output as the portable one. Build with BLAKE3_TESTING defined, so
+// the implementation can be forced through `g_cpu_features`.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blake3_impl.h"
+
+// Lengths around the block, chunk and SIMD degree boundaries, up to 2 MB
+static const size_t lengths[] = {
+    0,     1,     63,    64,    65,     1023,   1024,   1025,
+    2048,  2049,  3072,  4096,  4097,   5120,   7168,   8192,
+    8193,  16384, 16385, 31744, 65536,  65537,  102400, 1000003,
+    1 << 21, (1 << 21) + 1};
+#define LENGTH_COUNT (sizeof(lengths) / sizeof(lengths[0]))
+#define MODE_COUNT 3
+#define OUT_LEN 131
+// An output offset past 2^32 blocks, where the low word of the counter wraps
+#define SEEK ((UINT64_C(1) << 32) * BLAKE3_BLOCK_LEN + 17)
+
+static uint8_t input[(1 << 21) + 1];
+static uint8_t expected[LENGTH_COUNT][MODE_COUNT][2][OUT_LEN];
+static uint8_t actual[LENGTH_COUNT][MODE_COUNT][2][OUT_LEN];
+
+static const char *empty_hash =
+    "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262";
+
+// Hash every length in every mode, feeding the input in uneven pieces, and
+// keep the output from the start and from `SEEK`.
+static void hash_all(uint8_t out[LENGTH_COUNT][MODE_COUNT][2][OUT_LEN]) {
+  uint8_t key[BLAKE3_KEY_LEN];
+  memcpy(key, "whats the Elvish word for friend", BLAKE3_KEY_LEN);
+  for (size_t k = 0; k < LENGTH_COUNT; k++) {
+    for (int mode = 0; mode < MODE_COUNT; mode++) {
+      blake3_hasher hasher;
+      if (mode == 0) {
+        blake3_hasher_init(&hasher);
+      } else if (mode == 1) {
+        blake3_hasher_init_keyed(&hasher, key);
+      } else {
+        blake3_hasher_init_derive_key(
+            &hasher, "BLAKE3 2019-12-27 16:29:52 test vectors context");
+      }
+      size_t offset = 0, step = 1;
+      while (offset < lengths[k]) {
+        size_t n = step < lengths[k] - offset ? step : lengths[k] - offset;
+        blake3_hasher_update(&hasher, input + offset, n);
+        offset += n;
+        step = step * 7 + 3;
+      }
+      blake3_hasher_finalize(&hasher, out[k][mode][0], OUT_LEN);
+      blake3_hasher_finalize_seek(&hasher, SEEK, out[k][mode][1], OUT_LEN);
+    }
+  }
+}
+
+// Check the hash of the empty input against the reference test vector
+static int check_empty_hash(void) {
+  char hex[2 * BLAKE3_OUT_LEN + 1];
+  for (size_t i = 0; i < BLAKE3_OUT_LEN; i++) {
+    sprintf(hex + 2 * i, "%02x", actual[0][0][0][i]);
+  }
+  return strcmp(hex, empty_hash) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+  static const struct {
+    const char *name;
+    int features;
+  } backends[] = {{"portable", 0},
+                  {"sse2", SSE2},
+                  {"sse41", SSE2 | SSE41},
+                  {"avx2", SSE2 | SSE41 | AVX2},
+                  {"avx512", SSE2 | SSE41 | AVX2 | AVX512F}};
+  for (size_t i = 0; i < sizeof(input); i++) input[i] = (uint8_t)(i % 251);
+  ATOMIC_STORE(g_cpu_features, UNDEFINED);
+  const int detected = get_cpu_features();
+  ATOMIC_STORE(g_cpu_features, 0);
+  hash_all(expected);
+  int failed = 0;
+  for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+    if ((backends[b].features & detected) != backends[b].features) {
+      printf("%s: not supported, skipped\n", backends[b].name);
+      continue;
+    }
+    ATOMIC_STORE(g_cpu_features, backends[b].features);
+    hash_all(actual);
+    int ok = check_empty_hash();
+    if (!ok) printf("%s: wrong hash of the empty input\n", backends[b].name);
+    for (size_t k = 0; k < LENGTH_COUNT; k++) {
+      for (int mode = 0; mode < MODE_COUNT; mode++) {
+        if (memcmp(actual[k][mode], expected[k][mode], 2 * OUT_LEN) != 0) {
+          printf("%s: mismatch for length %zu in mode %d\n", backends[b].name,
+                 lengths[k], mode);
+          ok = 0;
+        }
+      }
+    }
+    printf("%s: %s\n", backends[b].name, ok ? "OK" : "FAILED");
+    if (!ok) failed = 1;
+  }
+  return failed;
+}